@@ -52,9 +52,10 @@ static int iterate_post(void* coninfo_cls,
 std::string HTTPServer::Execute(const std::string& url,
                                 const std::string& method,
                                 const POSTValues& pv) {
-    std::unique_lock<std::mutex> lk(cb_mutex_);
-    auto res = callbacks_.find(url);
-    if (res != callbacks_.end()) {
+    // keeps the table alive during the call, even if replaced meanwhile
+    std::shared_ptr<const Routes> routes = std::atomic_load(&callbacks_);
+    auto res = routes->find(url);
+    if (res != routes->end()) {
         return res->second(method, pv);
     }
     return error404_;
@@ -106,8 +107,11 @@ static int answer_to_connection(void* cls,
 }
 
 void HTTPServer::RegisterUrl(const std::string& str, UrlHandler f) {
-    std::unique_lock<std::mutex> lk(cb_mutex_);
-    callbacks_.insert(std::make_pair(str, std::move(f)));
+    std::unique_lock<std::mutex> lk(register_mutex_);
+    auto routes = std::make_shared<Routes>(*std::atomic_load(&callbacks_));
+    routes->insert(std::make_pair(str, std::move(f)));
+    std::atomic_store(&callbacks_,
+                      std::shared_ptr<const Routes>(std::move(routes)));
 }
 
 HTTPServer::~HTTPServer() { MHD_stop_daemon(daemon_); }
@@ -118,10 +122,14 @@ void HTTPServer::ServiceLoopForever() {
 }
 
 HTTPServer::HTTPServer(int port)
-    : error404_(
+    : callbacks_(std::make_shared<const Routes>()),
+      error404_(
           "<html><head><title>Not found</title></head><body>Go "
           "away.</body></html>") {
-    daemon_ = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY,
+    // a thread per connection: Execute() takes no lock, the handlers run
+    // concurrently
+    daemon_ = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY |
+                                   MHD_USE_THREAD_PER_CONNECTION,
                                port,
                                nullptr,
                                nullptr,
@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 
@@ -19,6 +20,8 @@ class HTTPServer {
     ~HTTPServer();
     void ServiceLoopForever();
 
+    // May be called while serving: the routes are copied, and the new table
+    // replaces the old one for the requests arriving after
     void RegisterUrl(const std::string& str, UrlHandler f);
 
     void StopService() {
@@ -26,16 +29,23 @@ class HTTPServer {
         stop_signal_.notify_all();
     }
 
+    // Runs the handler of url without holding any lock of the server. Every
+    // connection has a thread of its own: handlers must be thread-safe.
     std::string Execute(const std::string& url,
                         const std::string& method,
                         const POSTValues& pv);
 
    private:
+    typedef std::map<std::string, UrlHandler> Routes;
+
     MHD_Daemon* daemon_;
     bool running_;
-    mutable std::mutex cb_mutex_;
+    // serializes RegisterUrl()
+    std::mutex register_mutex_;
     std::mutex stop_mutex_;
     std::condition_variable stop_signal_;
-    std::map<std::string, UrlHandler> callbacks_;
+    // never modified once published, only replaced, through
+    // std::atomic_load() / std::atomic_store()
+    std::shared_ptr<const Routes> callbacks_;
     std::string error404_;
 };
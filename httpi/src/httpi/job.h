@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <map>
@@ -9,15 +10,17 @@
 template <class PackagedJob>
 class Job {
     std::unique_ptr<PackagedJob> job_;
-    std::future<void> future_;
+    // shared: IsFinished() may be called from several request threads
+    std::shared_future<void> future_;
     std::chrono::system_clock::time_point start_;
-    mutable bool finished_ = false;
+    mutable std::atomic<bool> finished_{false};
 
    public:
     Job(std::unique_ptr<PackagedJob> job)
         : job_(std::move(job)),
           future_(
-              std::async(std::launch::async, &PackagedJob::Do, job_.get())) {}
+              std::async(std::launch::async, &PackagedJob::Do, job_.get())
+                  .share()) {}
 
     bool IsFinished() const {
         if (finished_ == false) {
@@ -7,11 +7,12 @@
 #include "job.h"
 
 class WebJob {
+    // replaced by the job's thread, read by the request threads
     std::shared_ptr<std::string> res_;
 
    public:
     WebJob() : res_(std::make_shared<std::string>("empty")) {}
-    std::shared_ptr<std::string> page() { return res_; }
+    std::shared_ptr<std::string> page() { return std::atomic_load(&res_); }
     virtual void Do() = 0;
     virtual void Stop() = 0;
     ~WebJob() = default;
@@ -19,7 +20,7 @@ class WebJob {
 
    protected:
     void SetPage(const httpi::html::Html& html) {
-        res_ = std::make_shared<std::string>(html.Get());
+        std::atomic_store(&res_, std::make_shared<std::string>(html.Get()));
     }
 };
 
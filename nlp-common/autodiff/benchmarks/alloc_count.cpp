@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <ad/ad.h>
+
+// Counts every heap allocation made by the process. operator new, Eigen's
+// aligned_allocator and the arena chunks all end up in malloc, which is
+// replaced here by a counting wrapper around glibc's own.
+static size_t nb_allocs = 0;
+
+extern "C" {
+
+void* __libc_malloc(size_t sz);
+void* __libc_calloc(size_t n, size_t sz);
+void* __libc_realloc(void* p, size_t sz);
+void* __libc_memalign(size_t align, size_t sz);
+
+void* malloc(size_t sz) {
+    ++nb_allocs;
+    return __libc_malloc(sz);
+}
+
+void* calloc(size_t n, size_t sz) {
+    ++nb_allocs;
+    return __libc_calloc(n, sz);
+}
+
+void* realloc(void* p, size_t sz) {
+    ++nb_allocs;
+    return __libc_realloc(p, sz);
+}
+
+void* aligned_alloc(size_t align, size_t sz) {
+    ++nb_allocs;
+    return __libc_memalign(align, sz);
+}
+
+int posix_memalign(void** p, size_t align, size_t sz) {
+    ++nb_allocs;
+    *p = __libc_memalign(align, sz);
+    return *p ? 0 : ENOMEM;
+}
+
+} // extern "C"
+
+static const int kInputSize = 2000;
+static const int kOutputSize = 20;
+static const int kNbExamples = 1000;
+
+// The graph of BagOfWords::Train: a sparse one hot input, the sparse
+// gradient of w and SoftmaxCrossEntropy(y, w * x + b) with a regularizer.
+struct Model {
+    ad::Var w, b, x, y, logits, J;
+
+    Model(ad::ComputationGraph& g,
+          std::shared_ptr<Eigen::MatrixXd> w_weights,
+          std::shared_ptr<Eigen::MatrixXd> b_weights)
+        : w(g.CreateSparseGradParam(w_weights)),
+          b(g.CreateParam(b_weights)),
+          x(g.CreateSparseConstant(kInputSize, 1)),
+          y(g.CreateConstant(kOutputSize, 1)),
+          logits(ad::Affine(w, x, b)),
+          J(ad::SoftmaxCrossEntropy(y, logits)
+                  + 0.001 * ad::Mean(ad::EltSquare(b))) {}
+};
+
+static void SetExample(Model& m, int example) {
+    int a = (example * 7) % kInputSize;
+    int b = (example * 13) % kInputSize;
+    auto& input = m.x.sparse_value();
+    input.setZero();
+    input.reserve(2);
+    input.startVec(0);
+    input.insertBack(std::min(a, b), 0) = 1;
+    if (a != b) {
+        input.insertBack(std::max(a, b), 0) = 1;
+    }
+    input.finalize();
+
+    m.y.value().setZero();
+    m.y.value()(example % kOutputSize, 0) = 1;
+}
+
+static void Update(ad::ComputationGraph& g, Model& m) {
+    static ad::opt::SGD sgd(0.01);
+    g.ClearGrad();
+    g.BackpropFrom(m.J);
+    g.Update(sgd, {&m.w, &m.b});
+}
+
+// Builds the graph of the example in g and trains on it
+static void TrainStep(ad::ComputationGraph& g,
+        std::shared_ptr<Eigen::MatrixXd> w_weights,
+        std::shared_ptr<Eigen::MatrixXd> b_weights,
+        int example) {
+    Model m(g, w_weights, b_weights);
+    SetExample(m, example);
+    g.Forward();
+    Update(g, m);
+}
+
+int main() {
+    auto w_weights = std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(kOutputSize, kInputSize));
+    auto b_weights = std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(kOutputSize, 1));
+
+    size_t before = nb_allocs;
+    size_t fresh_chunks = 0;
+    for (int i = 0; i < kNbExamples; ++i) {
+        ad::ComputationGraph g;
+        TrainStep(g, w_weights, b_weights, i);
+        fresh_chunks += g.arena().nb_chunk_allocs();
+    }
+    size_t fresh = nb_allocs - before;
+
+    ad::ComputationGraph g;
+    // warm up: the first pass sizes the graph's arena and node pool, the
+    // Reset() after it merges the arena chunks into one
+    TrainStep(g, w_weights, b_weights, 1);
+    g.Reset();
+    TrainStep(g, w_weights, b_weights, 1);
+
+    before = nb_allocs;
+    size_t chunks_before = g.arena().nb_chunk_allocs();
+    for (int i = 0; i < kNbExamples; ++i) {
+        g.Reset();
+        TrainStep(g, w_weights, b_weights, i);
+    }
+    size_t reused = nb_allocs - before;
+    size_t reused_chunks = g.arena().nb_chunk_allocs() - chunks_before;
+
+    // what BagOfWords does: capture the graph once, then replay it
+    ad::ComputationGraph captured;
+    Model m(captured, w_weights, b_weights);
+    captured.PlanMemory(m.J, {m.logits});
+    // warm up: sizes the sparse input and the sparse gradient of w for
+    // two words
+    SetExample(m, 1);
+    captured.Forward();
+    Update(captured, m);
+
+    before = nb_allocs;
+    chunks_before = captured.arena().nb_chunk_allocs();
+    for (int i = 0; i < kNbExamples; ++i) {
+        SetExample(m, i);
+        captured.Forward();
+        Update(captured, m);
+    }
+    size_t replayed = nb_allocs - before;
+    size_t replayed_chunks =
+        captured.arena().nb_chunk_allocs() - chunks_before;
+
+    std::cout << "new graph per example: " << fresh << " allocations ("
+        << (double)fresh / kNbExamples << " per example), "
+        << fresh_chunks << " arena chunks\n";
+    std::cout << "reused graph:          " << reused << " allocations ("
+        << (double)reused / kNbExamples << " per example), "
+        << reused_chunks << " arena chunks, "
+        << g.arena().capacity() * sizeof (double) << " bytes of arena\n";
+    std::cout << "captured graph:        " << replayed << " allocations ("
+        << (double)replayed / kNbExamples << " per example), "
+        << replayed_chunks << " arena chunks, "
+        << captured.arena().capacity() * sizeof (double)
+        << " bytes of arena\n";
+    return 0;
+}
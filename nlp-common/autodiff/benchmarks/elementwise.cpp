@@ -0,0 +1,133 @@
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <ad/ad.h>
+#include <ad/kernels.h>
+
+// Throughput of the elementwise operators and of the kernels behind them,
+// for inputs from a few to tens of thousands of elements.
+
+static const int kSizes[] = {16, 256, 4096, 65536};
+// Number of elements processed per measurement
+static const int kWork = 1 << 24;
+
+typedef ad::Var (*Op)(const ad::Var&);
+
+template <class F>
+static double NsPerElement(int size, F f) {
+    int reps = kWork / size;
+    f();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count()
+        / reps / size;
+}
+
+static Eigen::MatrixXd RandomInput(int size, double from, double to) {
+    Eigen::MatrixXd m = Eigen::MatrixXd::Random(size, 1);
+    return (m.array() + 1) * (to - from) / 2 + from;
+}
+
+static void BenchOp(const std::string& name, Op op, double from, double to) {
+    for (int size : kSizes) {
+        ad::ComputationGraph g;
+        ad::Var x = g.CreateParam(RandomInput(size, from, to));
+        ad::Var y = op(x);
+
+        double fwd = NsPerElement(size, [&]() { g.Forward(); });
+        double bwd = NsPerElement(size, [&]() {
+            g.ClearGrad();
+            g.BackpropFrom(y);
+        });
+        std::cout << std::setw(8) << name << std::setw(8) << size
+            << std::setw(12) << fwd << std::setw(12) << bwd << "\n";
+    }
+}
+
+// Largest error of f compared to ref, in units in the last place
+template <class F, class R>
+static double MaxUlp(const std::vector<double>& x, F f, R ref) {
+    std::vector<double> y(x.size());
+    f(x.data(), y.data(), x.size());
+    double worst = 0;
+    for (size_t i = 0; i < x.size(); ++i) {
+        double expected = ref(x[i]);
+        if (expected == 0 || std::isinf(expected)) {
+            continue;
+        }
+        double ulp = std::nextafter(std::fabs(expected), INFINITY)
+            - std::fabs(expected);
+        worst = std::max(worst, std::fabs(y[i] - expected) / ulp);
+    }
+    return worst;
+}
+
+static void BenchKernels() {
+    using namespace ad::kernels;
+
+    std::vector<double> exp_in(100000);
+    std::vector<double> log_in(100000);
+    for (size_t i = 0; i < exp_in.size(); ++i) {
+        exp_in[i] = -708 + 1417.0 * i / exp_in.size();
+        log_in[i] = std::pow(10, -300 + 600.0 * i / log_in.size());
+    }
+
+    const int size = 4096;
+    std::vector<double> x(exp_in.begin(), exp_in.begin() + size);
+    std::vector<double> lx(log_in.begin(), log_in.begin() + size);
+    std::vector<double> y(size);
+
+    std::cout << "kernel      exp ns   exp ulp   log ns   log ulp\n";
+    double libm_exp = NsPerElement(size, [&]() {
+        for (int i = 0; i < size; ++i) {
+            y[i] = std::exp(x[i]);
+        }
+    });
+    double libm_log = NsPerElement(size, [&]() {
+        for (int i = 0; i < size; ++i) {
+            y[i] = std::log(lx[i]);
+        }
+    });
+    std::cout << std::setw(8) << "libm" << std::setw(9) << libm_exp
+        << std::setw(10) << 0 << std::setw(9) << libm_log
+        << std::setw(10) << 0 << "\n";
+
+    for (const KernelTable* k : SupportedKernels()) {
+        double exp_ns = NsPerElement(size, [&]() {
+            k->exp(x.data(), y.data(), size);
+        });
+        double log_ns = NsPerElement(size, [&]() {
+            k->log(lx.data(), y.data(), size);
+        });
+        double exp_ulp = MaxUlp(exp_in, k->exp, [](double a) {
+            return std::exp(a);
+        });
+        double log_ulp = MaxUlp(log_in, k->log, [](double a) {
+            return std::log(a);
+        });
+        std::cout << std::setw(8) << k->name << std::setw(9) << exp_ns
+            << std::setw(10) << exp_ulp << std::setw(9) << log_ns
+            << std::setw(10) << log_ulp << "\n";
+    }
+    std::cout << "selected: " << Kernels().name << "\n\n";
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+    BenchKernels();
+
+    std::cout << "      op    size  fwd ns/elt  bwd ns/elt\n";
+    BenchOp("Log", ad::Log, 0.1, 10);
+    BenchOp("NLog", ad::NLog, 0.1, 10);
+    BenchOp("Exp", ad::Exp, -5, 5);
+    BenchOp("Softmax", ad::Softmax, -5, 5);
+    BenchOp("Sigmoid", ad::Sigmoid, -5, 5);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <ad/ad.h>
+
+// Peak memory of the buffers of a deep MLP before and after PlanMemory(), for
+// training and for inference, and check that planning does not change the
+// loss or the gradients.
+
+static const int kBatchSize = 64;
+static const int kInputSize = 128;
+static const int kHiddenSize = 256;
+static const int kOutputSize = 10;
+
+struct Mlp {
+    ad::ComputationGraph g;
+    std::vector<ad::Var> params;
+    ad::Var x;
+    ad::Var y;
+    ad::Var h;
+    ad::Var J;
+
+    Mlp(const std::vector<std::shared_ptr<Eigen::MatrixXd>>& weights,
+            bool train)
+        : x(nullptr), y(nullptr), h(nullptr), J(nullptr) {
+        using namespace ad;
+
+        g.SetGradEnabled(train);
+        for (auto& w : weights) {
+            params.push_back(g.CreateParam(w));
+        }
+        x = g.CreateConstant(kInputSize, kBatchSize);
+        y = g.CreateConstant(kOutputSize, kBatchSize);
+
+        Var a = x;
+        for (size_t i = 0; i + 2 < params.size(); i += 2) {
+            a = Relu(Affine(params[i], a, params[i + 1]));
+        }
+        h = Affine(params[params.size() - 2], a, params.back());
+        J = SoftmaxCrossEntropy(y, h);
+    }
+
+    double Pass(const Eigen::MatrixXd& input, const Eigen::MatrixXd& target) {
+        x.value() = input;
+        y.value() = target;
+        g.Forward();
+        g.ClearGrad();
+        g.BackpropFrom(J);
+        return J.value()(0, 0);
+    }
+};
+
+static std::vector<std::shared_ptr<Eigen::MatrixXd>> MakeWeights(int depth) {
+    std::vector<std::shared_ptr<Eigen::MatrixXd>> weights;
+    int in = kInputSize;
+    for (int i = 0; i < depth; ++i) {
+        int out = i + 1 == depth ? kOutputSize : kHiddenSize;
+        weights.push_back(std::make_shared<Eigen::MatrixXd>(
+                    Eigen::MatrixXd::Random(out, in) * 0.1));
+        weights.push_back(std::make_shared<Eigen::MatrixXd>(
+                    Eigen::MatrixXd::Random(out, 1) * 0.1));
+        in = out;
+    }
+    return weights;
+}
+
+int main() {
+    Eigen::MatrixXd input = Eigen::MatrixXd::Random(kInputSize, kBatchSize);
+    Eigen::MatrixXd target = Eigen::MatrixXd::Zero(kOutputSize, kBatchSize);
+    for (int i = 0; i < kBatchSize; ++i) {
+        target(rand() % kOutputSize, i) = 1;
+    }
+
+    std::cout << "depth\ttraining KiB\t\tinference KiB\n"
+        << "\tnaive\tplanned\t\tnaive\tplanned\n";
+    for (int depth : {2, 4, 8, 16, 32}) {
+        auto weights = MakeWeights(depth);
+        Mlp naive(weights, true);
+        Mlp planned(weights, true);
+        ad::MemoryPlan plan = planned.g.PlanMemory(planned.J);
+        Mlp infer(weights, false);
+        ad::MemoryPlan infer_plan = infer.g.PlanMemory(infer.J, {infer.h});
+
+        double loss_diff = 0;
+        double grad_diff = 0;
+        // twice, to check that the shared buffers are cleared between passes
+        for (int pass = 0; pass < 2; ++pass) {
+            loss_diff = std::max(loss_diff, std::abs(
+                    naive.Pass(input, target) - planned.Pass(input, target)));
+            for (size_t i = 0; i < weights.size(); ++i) {
+                grad_diff = std::max(grad_diff, (naive.params[i].derivative()
+                        - planned.params[i].derivative()).cwiseAbs().maxCoeff());
+            }
+        }
+
+        std::cout << depth << "\t" << plan.naive_bytes / 1024 << "\t"
+            << plan.planned_bytes / 1024 << "\t\t"
+            << infer_plan.naive_bytes / 1024 << "\t"
+            << infer_plan.planned_bytes / 1024 << "\n";
+        if (loss_diff != 0 || grad_diff != 0) {
+            std::cout << "planned and naive passes differ by "
+                << std::max(loss_diff, grad_diff) << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
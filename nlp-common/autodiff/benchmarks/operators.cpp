@@ -0,0 +1,226 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ad/ad.h>
+
+// Time of the forward and backward pass of every operator of operators.h, of
+// building and backpropagating through a small model, and of the optimizer
+// updates, for square operands of a few sizes.
+
+static const int kSizes[] = {4, 16, 64, 256};
+// Minimum time spent measuring each number
+static const double kMinNs = 2e7;
+
+template <class F>
+static double NsPerCall(F f) {
+    f();
+    int reps = 0;
+    double elapsed = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed < kMinNs) {
+        f();
+        ++reps;
+        elapsed = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+    return elapsed / reps;
+}
+
+static std::shared_ptr<Eigen::MatrixXd> Random(int rows, int cols) {
+    return std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(rows, cols));
+}
+
+// Between 0.5 and 1.5, for Log and NLog
+static std::shared_ptr<Eigen::MatrixXd> Positive(int rows, int cols) {
+    return std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(rows, cols).array() * 0.5 + 1);
+}
+
+// A tenth of the coefficients are non zero
+static Eigen::SparseMatrix<double> SparseRandom(int rows, int cols) {
+    Eigen::MatrixXd m = Eigen::MatrixXd::Random(rows, cols);
+    Eigen::MatrixXd pruned = (m.array().abs() > 0.9).select(m, 0);
+    return pruned.sparseView();
+}
+
+// Builds the operator on g from operands of size n x n
+typedef std::function<ad::Var(ad::ComputationGraph& g, int n)> OpBuilder;
+
+static void BenchOp(const std::string& name, const OpBuilder& build) {
+    for (int n : kSizes) {
+        ad::ComputationGraph g;
+        ad::Var y = build(g, n);
+
+        // only the operator is not a leaf: Forward() only computes it
+        double fwd = NsPerCall([&]() { g.Forward(); });
+        double bwd = NsPerCall([&]() {
+            g.ClearGrad();
+            g.BackpropFrom(y);
+        });
+        std::cout << std::setw(22) << name << std::setw(6) << n
+            << std::setw(14) << fwd << std::setw(14) << bwd << "\n";
+    }
+}
+
+static void BenchOps() {
+    using namespace ad;
+    typedef ComputationGraph G;
+
+    std::cout << "                    op     n        fwd ns        bwd ns\n";
+    BenchOp("operator+", [](G& g, int n) {
+        return g.CreateParam(Random(n, n)) + g.CreateParam(Random(n, n));
+    });
+    BenchOp("operator-", [](G& g, int n) {
+        return g.CreateParam(Random(n, n)) - g.CreateParam(Random(n, n));
+    });
+    BenchOp("operator*", [](G& g, int n) {
+        return g.CreateParam(Random(n, n)) * g.CreateParam(Random(n, n));
+    });
+    BenchOp("operator* sparse", [](G& g, int n) {
+        return g.CreateSparseGradParam(Random(n, n))
+            * g.CreateSparseConstant(SparseRandom(n, n));
+    });
+    BenchOp("operator* scalar", [](G& g, int n) {
+        return 3 * g.CreateParam(Random(n, n));
+    });
+    BenchOp("Relu", [](G& g, int n) {
+        return Relu(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Square", [](G& g, int n) {
+        return Square(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("EltSquare", [](G& g, int n) {
+        return EltSquare(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("operator^", [](G& g, int n) {
+        return g.CreateParam(Random(n, n)) ^ g.CreateParam(Random(n, n));
+    });
+    BenchOp("Log", [](G& g, int n) {
+        return Log(g.CreateParam(Positive(n, n)));
+    });
+    BenchOp("NLog", [](G& g, int n) {
+        return NLog(g.CreateParam(Positive(n, n)));
+    });
+    BenchOp("Exp", [](G& g, int n) {
+        return Exp(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Softmax", [](G& g, int n) {
+        return Softmax(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Sigmoid", [](G& g, int n) {
+        return Sigmoid(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Sum", [](G& g, int n) {
+        return Sum(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Mean", [](G& g, int n) {
+        return Mean(g.CreateParam(Random(n, n)));
+    });
+    BenchOp("SoftmaxCrossEntropy", [](G& g, int n) {
+        return SoftmaxCrossEntropy(g.CreateConstant(*Positive(n, n)),
+                g.CreateParam(Random(n, n)));
+    });
+    BenchOp("Affine", [](G& g, int n) {
+        return Affine(g.CreateParam(Random(n, n)),
+                g.CreateConstant(*Random(n, n)), g.CreateParam(Random(n, 1)));
+    });
+    BenchOp("Affine sparse", [](G& g, int n) {
+        return Affine(g.CreateSparseGradParam(Random(n, n)),
+                g.CreateSparseConstant(SparseRandom(n, n)),
+                g.CreateParam(Random(n, 1)));
+    });
+    std::cout << "\n";
+}
+
+// A 3 layers perceptron on a single example
+static ad::Var Mlp(ad::ComputationGraph& g,
+        const std::vector<std::shared_ptr<Eigen::MatrixXd>>& weights,
+        const Eigen::MatrixXd& input) {
+    using namespace ad;
+    Var h = g.CreateConstant(input);
+    for (size_t i = 0; i + 1 < weights.size(); i += 2) {
+        h = Sigmoid(Affine(g.CreateParam(weights[i]), h,
+                    g.CreateParam(weights[i + 1])));
+    }
+    return Sum(h);
+}
+
+// Building a new graph, resetting one or replaying a captured one: the
+// difference between them is the cost of the tape itself
+static void BenchGraph() {
+    std::cout << "     n    new graph ns  reset graph ns     replay ns\n";
+    for (int n : kSizes) {
+        std::vector<std::shared_ptr<Eigen::MatrixXd>> weights;
+        for (int i = 0; i < 3; ++i) {
+            weights.push_back(Random(n, n));
+            weights.push_back(Random(n, 1));
+        }
+        Eigen::MatrixXd input = Eigen::MatrixXd::Random(n, 1);
+
+        double fresh = NsPerCall([&]() {
+            ad::ComputationGraph g;
+            ad::Var J = Mlp(g, weights, input);
+            g.BackpropFrom(J);
+        });
+
+        ad::ComputationGraph reused;
+        double reset = NsPerCall([&]() {
+            reused.Reset();
+            ad::Var J = Mlp(reused, weights, input);
+            reused.BackpropFrom(J);
+        });
+
+        ad::ComputationGraph captured;
+        ad::Var J = Mlp(captured, weights, input);
+        double replay = NsPerCall([&]() {
+            captured.Forward();
+            captured.ClearGrad();
+            captured.BackpropFrom(J);
+        });
+
+        std::cout << std::setw(6) << n << std::setw(16) << fresh
+            << std::setw(16) << reset << std::setw(14) << replay << "\n";
+    }
+    std::cout << "\n";
+}
+
+static void BenchOptimizer(const std::string& name, ad::Optimizer& opt) {
+    for (int n : kSizes) {
+        ad::ComputationGraph g;
+        ad::Var p = g.CreateParam(Random(n, n));
+        p.derivative() = Eigen::MatrixXd::Random(n, n) * 0.01;
+        double ns = NsPerCall([&]() { opt.Update(p); });
+        std::cout << std::setw(10) << name << std::setw(6) << n
+            << std::setw(14) << ns << "\n";
+    }
+}
+
+static void BenchOptimizers() {
+    using namespace ad::opt;
+
+    std::cout << "       opt     n     update ns\n";
+    SGD sgd(0.01);
+    BenchOptimizer("SGD", sgd);
+    Momentum momentum(0.01, 0.9);
+    BenchOptimizer("Momentum", momentum);
+    Adagrad adagrad(0.1);
+    BenchOptimizer("Adagrad", adagrad);
+    Adam adam(0.001);
+    BenchOptimizer("Adam", adam);
+    FTRL ftrl(0.1, 1, 0.001, 0);
+    BenchOptimizer("FTRL", ftrl);
+}
+
+int main() {
+    std::cout << std::fixed << std::setprecision(1);
+    BenchOps();
+    BenchGraph();
+    BenchOptimizers();
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <ad/ad.h>
+
+// Forward and backward pass of the BagOfWords objective,
+// SoftmaxCrossEntropy(y, w * x + b) + 0.001 * Mean(EltSquare(b)), on the
+// dynamic ComputationGraph and on the expression templates of ad/expr.h.
+
+static const int kInputSize = 64;
+static const int kNbWordsPerExample = 6;
+static const int kNbExamples = 4096;
+static const int kNbRuns = 50;
+
+struct Example {
+    Eigen::MatrixXd x;
+    Eigen::MatrixXd y;
+};
+
+static std::vector<Example> MakeExamples(int nb_labels) {
+    std::vector<Example> examples(kNbExamples);
+    for (auto& ex : examples) {
+        ex.x = Eigen::MatrixXd::Zero(kInputSize, 1);
+        for (int i = 0; i < kNbWordsPerExample; ++i) {
+            ex.x(rand() % kInputSize, 0) = 1;
+        }
+        ex.y = Eigen::MatrixXd::Zero(nb_labels, 1);
+        ex.y(rand() % nb_labels, 0) = 1;
+    }
+    return examples;
+}
+
+// ns per example of f(example)
+template <class F>
+static double Time(const std::vector<Example>& examples, F f) {
+    for (auto& ex : examples) {
+        f(ex);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < kNbRuns; ++run) {
+        for (auto& ex : examples) {
+            f(ex);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count()
+        / kNbRuns / examples.size();
+}
+
+template <int L>
+static void Bench() {
+    using namespace ad;
+
+    auto examples = MakeExamples(L);
+    auto w_weights = std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(L, kInputSize));
+    auto b_weights = std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(L, 1));
+    double loss = 0;
+
+    // a new graph for every example
+    ComputationGraph rebuilt;
+    Eigen::MatrixXd dyn_dw;
+    double rebuilt_ns = Time(examples, [&](const Example& ex) {
+        rebuilt.Reset();
+        Var w = rebuilt.CreateParam(w_weights);
+        Var b = rebuilt.CreateParam(b_weights);
+        Var x = rebuilt.CreateConstant(ex.x);
+        Var y = rebuilt.CreateConstant(ex.y);
+        Var J = SoftmaxCrossEntropy(y, Affine(w, x, b))
+            + 0.001 * Mean(EltSquare(b));
+        rebuilt.BackpropFrom(J);
+        loss = J.value()(0, 0);
+        dyn_dw = w.derivative();
+    });
+    double dyn_loss = loss;
+
+    // captured once, replayed
+    ComputationGraph g;
+    Var w = g.CreateParam(w_weights);
+    Var b = g.CreateParam(b_weights);
+    Var x = g.CreateConstant(kInputSize, 1);
+    Var y = g.CreateConstant(L, 1);
+    Var J = SoftmaxCrossEntropy(y, Affine(w, x, b))
+        + 0.001 * Mean(EltSquare(b));
+    double replayed_ns = Time(examples, [&](const Example& ex) {
+        x.value() = ex.x;
+        y.value() = ex.y;
+        g.Forward();
+        g.ClearGrad();
+        g.BackpropFrom(J);
+    });
+
+    // expression templates, dimensions known at runtime
+    Eigen::MatrixXd dw(L, kInputSize);
+    Eigen::MatrixXd db(L, 1);
+    Eigen::MatrixXd xd(kInputSize, 1);
+    Eigen::MatrixXd yd(L, 1);
+    expr::Param<> ew(*w_weights, dw);
+    expr::Param<> eb(*b_weights, db);
+    auto dyn_expr = expr::SoftmaxCrossEntropy(expr::Const<>(yd),
+            expr::Affine(ew, expr::Const<>(xd), eb))
+        + 0.001 * expr::Mean(expr::EltSquare(eb));
+    double dyn_expr_ns = Time(examples, [&](const Example& ex) {
+        xd = ex.x;
+        yd = ex.y;
+        ew.ClearGrad();
+        eb.ClearGrad();
+        dyn_expr.Forward();
+        expr::BackpropFrom(dyn_expr);
+    });
+
+    // expression templates, fixed sizes
+    expr::Mat<L, kInputSize> fw = *w_weights;
+    expr::Mat<L, 1> fb = *b_weights;
+    expr::Mat<L, kInputSize> fdw;
+    expr::Mat<L, 1> fdb;
+    expr::Mat<kInputSize, 1> fx;
+    expr::Mat<L, 1> fy;
+    expr::Param<L, kInputSize> pw(fw, fdw);
+    expr::Param<L, 1> pb(fb, fdb);
+    auto fixed_expr = expr::SoftmaxCrossEntropy(expr::Const<L, 1>(fy),
+            expr::Affine(pw, expr::Const<kInputSize, 1>(fx), pb))
+        + 0.001 * expr::Mean(expr::EltSquare(pb));
+    double fixed_expr_ns = Time(examples, [&](const Example& ex) {
+        fx = ex.x;
+        fy = ex.y;
+        pw.ClearGrad();
+        pb.ClearGrad();
+        fixed_expr.Forward();
+        expr::BackpropFrom(fixed_expr);
+    });
+
+    // all of them ended on the last example
+    double diff = std::max({
+            (dyn_dw - w.derivative()).cwiseAbs().maxCoeff(),
+            (dyn_dw - dw).cwiseAbs().maxCoeff(),
+            (dyn_dw - fdw).cwiseAbs().maxCoeff(),
+            std::abs(dyn_loss - J.value()(0, 0)),
+            std::abs(dyn_loss - dyn_expr.value()(0, 0)),
+            std::abs(dyn_loss - fixed_expr.value()(0, 0))});
+
+    std::cout << std::setw(6) << L
+        << std::setw(10) << std::setprecision(0) << std::fixed << rebuilt_ns
+        << std::setw(10) << replayed_ns
+        << std::setw(10) << dyn_expr_ns
+        << std::setw(10) << fixed_expr_ns
+        << std::setw(12) << std::setprecision(1) << std::scientific << diff
+        << "\n";
+}
+
+int main() {
+    std::cout << "ns per example, " << kInputSize << " words\n"
+        << "labels   rebuilt  replayed  expr dyn  expr fix    max diff\n";
+    Bench<2>();
+    Bench<4>();
+    Bench<8>();
+    Bench<16>();
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include <ad/ad.h>
+
+// The linear regression of linear_regression.cpp, on mini-batches whose
+// gradient is computed by 4 threads.
+
+static const int kNbExamples = 1024;
+static const int kNbReplicas = 4;
+
+int main() {
+    using namespace ad;
+
+    Eigen::MatrixXd x(2, kNbExamples);
+    Eigen::MatrixXd y(1, kNbExamples);
+    for (int k = 0; k < kNbExamples; ++k) {
+        float x1 = (rand() % 30 - 15) / 15.;
+        float x2 = (rand() % 30 - 15) / 15.;
+        x(0, k) = x1;
+        x(1, k) = x2;
+        y(0, k) =  x1 * 8 + x2 * 3 + 5;
+    }
+
+    auto a_weights = std::make_shared<Eigen::MatrixXd>(1, 2);
+    *a_weights << 3, 4;
+    auto b_weights = std::make_shared<Eigen::MatrixXd>(1, 1);
+    *b_weights << 6;
+
+    // params[0] is a, params[1] is b
+    auto loss = [&](ComputationGraph& g, const std::vector<Var>& params,
+            size_t begin, size_t end) {
+        Var xs = g.CreateConstant(x.middleCols(begin, end - begin));
+        Var ys = g.CreateConstant(y.middleCols(begin, end - begin));
+        Var ones = g.CreateConstant(Eigen::MatrixXd::Ones(1, end - begin));
+        Var h = params[0] * xs + params[1] * ones;
+        return Sum(EltSquare(h - ys));
+    };
+
+    DataParallel trainer({a_weights, b_weights}, kNbReplicas);
+    opt::SGD sgd(0.1 / kNbExamples);
+    for (int i = 0; i < 100; ++i) {
+        double cost = trainer.Step(kNbExamples, loss, sgd);
+        std::cout << "COST = " << cost / kNbExamples << "\n";
+    }
+
+    std::cout << "a = " << *a_weights << " b = " << *b_weights << std::endl;
+    return 0;
+}
@@ -32,8 +32,8 @@ int main() {
         ComputationGraph g;
         auto dataset = GenDataset(nb_examples);
 
-        Var x = g.CreateParam(dataset.first);
-        Var y = g.CreateParam(dataset.second);
+        Var x = g.CreateConstant(dataset.first);
+        Var y = g.CreateConstant(dataset.second);
         Var a = g.CreateParam(a_weights);
         Var b = g.CreateParam(b_weights);
 
@@ -1,7 +1,16 @@
 #pragma once
 
+#include "data_parallel.h"
+#include "expr.h"
+#include "gradient_check.h"
 #include "graph.h"
 #include "operators.h"
 #include "optimizer.h"
+#include "optimizers/adagrad.h"
+#include "optimizers/adam.h"
+#include "optimizers/ftrl.h"
+#include "optimizers/momentum.h"
 #include "optimizers/sgd.h"
+#include "profiler.h"
+#include "thread_pool.h"
 
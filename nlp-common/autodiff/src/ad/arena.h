@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+
+#include "Eigen/Core"
+
+namespace ad {
+
+// Bump allocator for the numeric buffers of a ComputationGraph. Allocations
+// are never freed individually: Reset() rewinds the arena and keeps its
+// memory, so a graph reused for passes of the same shape stops allocating
+// after the first one.
+class Arena {
+    typedef std::vector<double, Eigen::aligned_allocator<double>> Chunk;
+
+    // Buffers are padded to this many doubles (32 bytes), so every one of
+    // them is as aligned as its chunk: EIGEN_MAX_ALIGN_BYTES, which is only
+    // 16 bytes unless AVX is enabled.
+    static const size_t kAlign = 4;
+    static const size_t kMinChunkSize = 1024;
+
+    std::vector<Chunk> chunks_;
+    size_t current_;
+    size_t used_;
+    size_t nb_chunk_allocs_;
+
+  public:
+    Arena() : current_(0), used_(0), nb_chunk_allocs_(0) {}
+
+    double* Allocate(size_t n) {
+        n = (n + kAlign - 1) / kAlign * kAlign;
+
+        if (!chunks_.empty() && used_ + n <= chunks_[current_].size()) {
+            double* ptr = chunks_[current_].data() + used_;
+            used_ += n;
+            return ptr;
+        }
+
+        // Chunks are only ever appended during a pass, so the current one is
+        // always the last one.
+        size_t size = chunks_.empty() ? kMinChunkSize : 2 * chunks_.back().size();
+        chunks_.emplace_back(n > size ? n : size);
+        ++nb_chunk_allocs_;
+        current_ = chunks_.size() - 1;
+        used_ = n;
+        return chunks_[current_].data();
+    }
+
+    // Forgets every allocation. If the last pass needed several chunks,
+    // they are merged into one big enough for the whole pass.
+    void Reset() {
+        if (chunks_.size() > 1) {
+            size_t total = capacity();
+            chunks_.clear();
+            chunks_.emplace_back(total);
+            ++nb_chunk_allocs_;
+        }
+        current_ = 0;
+        used_ = 0;
+    }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for (auto& c : chunks_) {
+            total += c.size();
+        }
+        return total;
+    }
+
+    // Number of chunks allocated since the arena was created, the merges
+    // made by Reset() included
+    size_t nb_chunk_allocs() const { return nb_chunk_allocs_; }
+};
+
+} // ad
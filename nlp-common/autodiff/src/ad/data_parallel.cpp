@@ -0,0 +1,81 @@
+#include <cassert>
+
+#include "data_parallel.h"
+
+namespace ad {
+
+DataParallel::DataParallel(
+        std::vector<std::shared_ptr<Eigen::MatrixXd>> params,
+        int nb_replicas,
+        ThreadPool* pool)
+    : params_(std::move(params)), pool_(pool) {
+    assert(nb_replicas >= 1);
+    for (int i = 0; i < nb_replicas; ++i) {
+        replicas_.emplace_back(new Replica);
+        replicas_.back()->grads.resize(params_.size());
+    }
+
+    if (!pool_) {
+        // the calling thread works too
+        own_pool_.reset(new ThreadPool(nb_replicas - 1));
+        pool_ = own_pool_.get();
+    }
+}
+
+void DataParallel::RunReplica(
+        int idx, size_t batch_size, const LossBuilder& loss) {
+    Replica& r = *replicas_[idx];
+    size_t begin = batch_size * idx / replicas_.size();
+    size_t end = batch_size * (idx + 1) / replicas_.size();
+
+    r.g.Reset();
+    r.params.clear();
+    for (auto& p : params_) {
+        r.params.push_back(r.g.CreateParam(p));
+    }
+
+    if (begin == end) {
+        for (size_t i = 0; i < params_.size(); ++i) {
+            r.grads[i].setZero(params_[i]->rows(), params_[i]->cols());
+        }
+        r.loss = 0;
+        return;
+    }
+
+    Var j = loss(r.g, r.params, begin, end);
+    r.g.BackpropFrom(j);
+    for (size_t i = 0; i < params_.size(); ++i) {
+        r.grads[i] = r.params[i].derivative();
+    }
+    r.loss = j.value()(0, 0);
+}
+
+double DataParallel::Step(
+        size_t batch_size, const LossBuilder& loss, Optimizer& opt) {
+    int nb = replicas_.size();
+    pool_->ParallelFor(nb, [&](int i) { RunReplica(i, batch_size, loss); });
+
+    // replica i accumulates replica i + stride, for stride = 1, 2, 4...
+    for (int stride = 1; stride < nb; stride *= 2) {
+        int nb_pairs = (nb - stride + 2 * stride - 1) / (2 * stride);
+        pool_->ParallelFor(nb_pairs, [&](int pair) {
+            Replica& dst = *replicas_[pair * 2 * stride];
+            Replica& src = *replicas_[pair * 2 * stride + stride];
+            for (size_t i = 0; i < params_.size(); ++i) {
+                dst.grads[i] += src.grads[i];
+            }
+            dst.loss += src.loss;
+        });
+    }
+
+    Replica& total = *replicas_[0];
+    update_graph_.Reset();
+    for (size_t i = 0; i < params_.size(); ++i) {
+        Var p = update_graph_.CreateParam(params_[i]);
+        p.derivative() = total.grads[i];
+        opt.Update(p);
+    }
+    return total.loss;
+}
+
+} // ad
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "graph.h"
+#include "optimizer.h"
+#include "thread_pool.h"
+
+namespace ad {
+
+// Synchronous data-parallel training. Every Step() splits the mini-batch in
+// as many contiguous shards as there are replicas. Each replica builds the
+// loss of its shard on its own graph, on its own thread, and copies the
+// gradients of the params into its own buffers. The buffers are then summed
+// by a tree reduction and a single optimizer step is applied to the shared
+// params.
+//
+// Shards and reduction order only depend on the batch size and the number of
+// replicas: results are the same whatever the threads' scheduling.
+class DataParallel {
+  public:
+    // Builds the loss of the examples [begin, end) on g. params are the
+    // shared params, created on g, in the order given to the constructor.
+    typedef std::function<Var(ComputationGraph& g,
+                              const std::vector<Var>& params,
+                              size_t begin,
+                              size_t end)> LossBuilder;
+
+    // nb_replicas must be at least 1. Without a pool, the replicas run on a
+    // pool of their own
+    DataParallel(std::vector<std::shared_ptr<Eigen::MatrixXd>> params,
+                 int nb_replicas,
+                 ThreadPool* pool = nullptr);
+
+    // Returns the loss summed over the examples [0, batch_size)
+    double Step(size_t batch_size, const LossBuilder& loss, Optimizer& opt);
+
+    int nb_replicas() const { return replicas_.size(); }
+
+  private:
+    struct Replica {
+        ComputationGraph g;
+        std::vector<Var> params;
+        std::vector<Eigen::MatrixXd> grads;
+        double loss;
+    };
+
+    void RunReplica(int idx, size_t batch_size, const LossBuilder& loss);
+
+    std::vector<std::shared_ptr<Eigen::MatrixXd>> params_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    std::unique_ptr<ThreadPool> own_pool_;
+    ThreadPool* pool_;
+    // holds the params and the reduced gradients for the optimizer
+    ComputationGraph update_graph_;
+};
+
+} // ad
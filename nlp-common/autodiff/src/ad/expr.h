@@ -0,0 +1,419 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+#include "Eigen/Dense"
+
+namespace ad {
+
+// Expression templates for models whose architecture is fixed. The
+// expression is a type built at compile time: no node is allocated, no
+// function pointer is called, and the forward and backward passes of the
+// whole expression are inlined. With dimensions known at compile time, every
+// value is a fixed-size Eigen matrix stored inside the expression.
+//
+//     expr::Param<4, 64> w(w_mat, w_grad);
+//     expr::Param<4, 1> b(b_mat, b_grad);
+//     expr::Const<64, 1> x(x_mat);
+//     expr::Const<4, 1> y(y_mat);
+//     auto J = SoftmaxCrossEntropy(y, Affine(w, x, b));
+//     J.Forward();
+//     BackpropFrom(J);
+//
+// Leaves only point to their matrices, which may be the shared matrices of
+// the params of a ComputationGraph. Use Eigen::Dynamic (the default) for
+// dimensions known at runtime only. Gradients are accumulated into the grad
+// matrix of the params: clear it between passes with ClearGrad().
+//
+// Subexpressions are copied into the expression using them: an expression
+// used twice is computed twice.
+namespace expr {
+
+template <int R, int C>
+using Mat = Eigen::Matrix<double, R, C>;
+
+// Base of every expression, restricts the operators below to them
+struct Expr {};
+
+template <class A, class B = Expr>
+using EnableIfExpr = typename std::enable_if<
+    std::is_base_of<Expr, A>::value && std::is_base_of<Expr, B>::value>::type;
+
+template <int R = Eigen::Dynamic, int C = Eigen::Dynamic>
+class Const : public Expr {
+  public:
+    typedef Mat<R, C> Value;
+    static const bool kRequiresGrad = false;
+
+    explicit Const(const Value& value) : value_(&value) {}
+
+    void Forward() {}
+    template <class D> void Backward(const D&) {}
+    const Value& value() const { return *value_; }
+
+  private:
+    const Value* value_;
+};
+
+template <int R = Eigen::Dynamic, int C = Eigen::Dynamic>
+class Param : public Expr {
+  public:
+    typedef Mat<R, C> Value;
+    static const bool kRequiresGrad = true;
+
+    // grad must have the dimensions of value
+    Param(Value& value, Value& grad) : value_(&value), grad_(&grad) {}
+
+    void Forward() {}
+    template <class D> void Backward(const D& d) { *grad_ += d; }
+    const Value& value() const { return *value_; }
+    Value& value() { return *value_; }
+    const Value& grad() const { return *grad_; }
+    Value& grad() { return *grad_; }
+    void ClearGrad() { grad_->setZero(); }
+
+  private:
+    Value* value_;
+    Value* grad_;
+};
+
+template <class A, class B>
+class AddExpr : public Expr {
+  public:
+    typedef typename A::Value Value;
+    static const bool kRequiresGrad = A::kRequiresGrad || B::kRequiresGrad;
+
+    AddExpr(const A& a, const B& b) : a_(a), b_(b) {}
+
+    void Forward() {
+        a_.Forward();
+        b_.Forward();
+        value_ = a_.value() + b_.value();
+    }
+
+    template <class D> void Backward(const D& d) {
+        if (A::kRequiresGrad) {
+            a_.Backward(d);
+        }
+        if (B::kRequiresGrad) {
+            b_.Backward(d);
+        }
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    B b_;
+    Value value_;
+};
+
+template <class A, class B>
+class SubExpr : public Expr {
+  public:
+    typedef typename A::Value Value;
+    static const bool kRequiresGrad = A::kRequiresGrad || B::kRequiresGrad;
+
+    SubExpr(const A& a, const B& b) : a_(a), b_(b) {}
+
+    void Forward() {
+        a_.Forward();
+        b_.Forward();
+        value_ = a_.value() - b_.value();
+    }
+
+    template <class D> void Backward(const D& d) {
+        if (A::kRequiresGrad) {
+            a_.Backward(d);
+        }
+        if (B::kRequiresGrad) {
+            b_.Backward(-d);
+        }
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    B b_;
+    Value value_;
+};
+
+template <class A>
+class ScaleExpr : public Expr {
+  public:
+    typedef typename A::Value Value;
+    static const bool kRequiresGrad = A::kRequiresGrad;
+
+    ScaleExpr(double coeff, const A& a) : coeff_(coeff), a_(a) {}
+
+    void Forward() {
+        a_.Forward();
+        value_ = coeff_ * a_.value();
+    }
+
+    template <class D> void Backward(const D& d) { a_.Backward(coeff_ * d); }
+
+    const Value& value() const { return value_; }
+
+  private:
+    double coeff_;
+    A a_;
+    Value value_;
+};
+
+template <class A, class B>
+class MulExpr : public Expr {
+  public:
+    typedef Mat<A::Value::RowsAtCompileTime, B::Value::ColsAtCompileTime> Value;
+    static const bool kRequiresGrad = A::kRequiresGrad || B::kRequiresGrad;
+
+    MulExpr(const A& a, const B& b) : a_(a), b_(b) {}
+
+    void Forward() {
+        a_.Forward();
+        b_.Forward();
+        value_.noalias() = a_.value() * b_.value();
+    }
+
+    template <class D> void Backward(const D& d) {
+        if (A::kRequiresGrad) {
+            a_.Backward(d * b_.value().transpose());
+        }
+        if (B::kRequiresGrad) {
+            b_.Backward(a_.value().transpose() * d);
+        }
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    B b_;
+    Value value_;
+};
+
+// w * x + b, b being broadcast over the columns of x
+template <class W, class X, class B>
+class AffineExpr : public Expr {
+  public:
+    typedef Mat<W::Value::RowsAtCompileTime, X::Value::ColsAtCompileTime> Value;
+    static const bool kRequiresGrad =
+        W::kRequiresGrad || X::kRequiresGrad || B::kRequiresGrad;
+
+    AffineExpr(const W& w, const X& x, const B& b) : w_(w), x_(x), b_(b) {}
+
+    void Forward() {
+        w_.Forward();
+        x_.Forward();
+        b_.Forward();
+        value_.noalias() = w_.value() * x_.value();
+        value_.colwise() += b_.value().col(0);
+    }
+
+    template <class D> void Backward(const D& d) {
+        if (W::kRequiresGrad) {
+            w_.Backward(d * x_.value().transpose());
+        }
+        if (X::kRequiresGrad) {
+            x_.Backward(w_.value().transpose() * d);
+        }
+        if (B::kRequiresGrad) {
+            b_.Backward(d.rowwise().sum());
+        }
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    W w_;
+    X x_;
+    B b_;
+    Value value_;
+};
+
+template <class A>
+class EltSquareExpr : public Expr {
+  public:
+    typedef typename A::Value Value;
+    static const bool kRequiresGrad = A::kRequiresGrad;
+
+    explicit EltSquareExpr(const A& a) : a_(a) {}
+
+    void Forward() {
+        a_.Forward();
+        value_ = a_.value().array().square();
+    }
+
+    template <class D> void Backward(const D& d) {
+        a_.Backward(2 * a_.value().cwiseProduct(d));
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    Value value_;
+};
+
+template <class A>
+class SigmoidExpr : public Expr {
+  public:
+    typedef typename A::Value Value;
+    static const bool kRequiresGrad = A::kRequiresGrad;
+
+    explicit SigmoidExpr(const A& a) : a_(a) {}
+
+    void Forward() {
+        a_.Forward();
+        value_ = 1 / (1 + (-a_.value().array()).exp());
+    }
+
+    template <class D> void Backward(const D& d) {
+        a_.Backward(d.cwiseProduct(
+                    value_.cwiseProduct((1 - value_.array()).matrix())));
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    Value value_;
+};
+
+// Sum of the coefficients, or their mean when kMean
+template <class A, bool kMean>
+class ReduceExpr : public Expr {
+  public:
+    typedef Mat<1, 1> Value;
+    static const bool kRequiresGrad = A::kRequiresGrad;
+
+    explicit ReduceExpr(const A& a) : a_(a) {}
+
+    void Forward() {
+        a_.Forward();
+        value_(0, 0) = kMean ? a_.value().mean() : a_.value().sum();
+    }
+
+    template <class D> void Backward(const D& d) {
+        Value dy = d;
+        double g = kMean ? dy(0, 0) / a_.value().size() : dy(0, 0);
+        a_.Backward(A::Value::Constant(
+                    a_.value().rows(), a_.value().cols(), g));
+    }
+
+    const Value& value() const { return value_; }
+
+  private:
+    A a_;
+    Value value_;
+};
+
+// -sum(y * log(softmax(x))), column by column, like ad::SoftmaxCrossEntropy
+template <class Y, class X>
+class SoftmaxCrossEntropyExpr : public Expr {
+  public:
+    typedef Mat<1, 1> Value;
+    static const bool kRequiresGrad = Y::kRequiresGrad || X::kRequiresGrad;
+
+    SoftmaxCrossEntropyExpr(const Y& y, const X& x) : y_(y), x_(x) {}
+
+    void Forward() {
+        y_.Forward();
+        x_.Forward();
+        const auto& x = x_.value();
+        const auto& y = y_.value();
+        probs_.resize(x.rows(), x.cols());
+        lse_.resize(1, x.cols());
+
+        double loss = 0;
+        for (int col = 0; col < x.cols(); ++col) {
+            double max = x.col(col).maxCoeff();
+            probs_.col(col) = (x.col(col).array() - max).exp();
+            double total = probs_.col(col).sum();
+            probs_.col(col) /= total;
+            lse_(0, col) = max + std::log(total);
+            loss -= y.col(col).dot(
+                    (x.col(col).array() - lse_(0, col)).matrix());
+        }
+        value_(0, 0) = loss;
+    }
+
+    template <class D> void Backward(const D& d) {
+        Value dy = d;
+        const auto& y = y_.value();
+        if (X::kRequiresGrad) {
+            grad_x_ = dy(0, 0) * (probs_ * y.colwise().sum().asDiagonal() - y);
+            x_.Backward(grad_x_);
+        }
+        if (Y::kRequiresGrad) {
+            grad_y_ = dy(0, 0) * ((-x_.value()).rowwise()
+                    + lse_.row(0));
+            y_.Backward(grad_y_);
+        }
+    }
+
+    const Value& value() const { return value_; }
+    // softmax(x), as computed by the last Forward()
+    const typename X::Value& probs() const { return probs_; }
+
+  private:
+    Y y_;
+    X x_;
+    Value value_;
+    typename X::Value probs_;
+    Mat<1, X::Value::ColsAtCompileTime> lse_;
+    typename X::Value grad_x_;
+    typename Y::Value grad_y_;
+};
+
+template <class A, class B, class = EnableIfExpr<A, B>>
+AddExpr<A, B> operator+(const A& a, const B& b) { return AddExpr<A, B>(a, b); }
+
+template <class A, class B, class = EnableIfExpr<A, B>>
+SubExpr<A, B> operator-(const A& a, const B& b) { return SubExpr<A, B>(a, b); }
+
+template <class A, class B, class = EnableIfExpr<A, B>>
+MulExpr<A, B> operator*(const A& a, const B& b) { return MulExpr<A, B>(a, b); }
+
+template <class A, class = EnableIfExpr<A>>
+ScaleExpr<A> operator*(double coeff, const A& a) {
+    return ScaleExpr<A>(coeff, a);
+}
+
+template <class A, class = EnableIfExpr<A>>
+ScaleExpr<A> operator*(const A& a, double coeff) {
+    return ScaleExpr<A>(coeff, a);
+}
+
+template <class W, class X, class B>
+AffineExpr<W, X, B> Affine(const W& w, const X& x, const B& b) {
+    return AffineExpr<W, X, B>(w, x, b);
+}
+
+template <class A>
+EltSquareExpr<A> EltSquare(const A& a) { return EltSquareExpr<A>(a); }
+
+template <class A>
+SigmoidExpr<A> Sigmoid(const A& a) { return SigmoidExpr<A>(a); }
+
+template <class A>
+ReduceExpr<A, false> Sum(const A& a) { return ReduceExpr<A, false>(a); }
+
+template <class A>
+ReduceExpr<A, true> Mean(const A& a) { return ReduceExpr<A, true>(a); }
+
+template <class Y, class X>
+SoftmaxCrossEntropyExpr<Y, X> SoftmaxCrossEntropy(const Y& y, const X& x) {
+    return SoftmaxCrossEntropyExpr<Y, X>(y, x);
+}
+
+// Backpropagates from e, whose Forward() has been called, into the params
+template <class E>
+void BackpropFrom(E& e) {
+    e.Backward(E::Value::Ones(e.value().rows(), e.value().cols()));
+}
+
+} // expr
+} // ad
@@ -0,0 +1,44 @@
+#include "gradient_check.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ad {
+
+double GradientError(const LossFn& loss,
+                     const std::vector<std::shared_ptr<Eigen::MatrixXd>>& params,
+                     double eps) {
+    ComputationGraph g;
+    std::vector<Var> vars;
+    for (auto& p : params) {
+        vars.push_back(g.CreateParam(p));
+    }
+    Var J = loss(g, vars);
+    assert(J.rows() == 1 && J.cols() == 1);
+    g.BackpropFrom(J);
+
+    double max_error = 0;
+    for (size_t i = 0; i < params.size(); ++i) {
+        Eigen::MatrixXd& p = *params[i];
+        const Eigen::MatrixXd analytic = vars[i].derivative();
+        for (int k = 0; k < p.size(); ++k) {
+            double orig = p.data()[k];
+            p.data()[k] = orig + eps;
+            g.Forward();
+            double plus = J.value()(0, 0);
+            p.data()[k] = orig - eps;
+            g.Forward();
+            double minus = J.value()(0, 0);
+            p.data()[k] = orig;
+
+            double numeric = (plus - minus) / (2 * eps);
+            double scale = std::max({1., std::abs(numeric),
+                    std::abs(analytic.data()[k])});
+            max_error = std::max(max_error,
+                    std::abs(numeric - analytic.data()[k]) / scale);
+        }
+    }
+    return max_error;
+}
+
+} // ad
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "graph.h"
+
+namespace ad {
+
+// Builds a 1x1 loss on g from params, created on g from the matrices given to
+// GradientError(), in the same order.
+typedef std::function<Var(ComputationGraph& g, const std::vector<Var>& params)>
+    LossFn;
+
+// Largest difference between the gradient of loss computed by BackpropFrom()
+// and central finite differences, relative to the magnitude of the gradient.
+// The graph is built once and replayed with Forward() for every perturbation
+// of the params, which are restored afterwards.
+double GradientError(const LossFn& loss,
+                     const std::vector<std::shared_ptr<Eigen::MatrixXd>>& params,
+                     double eps = 1e-6);
+
+} // ad
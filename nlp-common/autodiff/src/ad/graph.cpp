@@ -1,64 +1,426 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <queue>
+
 #include "graph.h"
 
 namespace ad {
 
-const Var no_operand(
-        new VarImpl(nullptr, Eigen::MatrixXd(1,1), -1, -1, -1, DoNothingBackprop));
+// The missing operand of unary operators. Backward passes them a null rhs,
+// so it has a value but no derivative, and does not require a gradient.
+static double no_operand_value;
+
+static VarImpl* MakeNoOperand() {
+    VarImpl* v = new VarImpl(nullptr);
+    v->Init(&no_operand_value, nullptr, 1, 1, -1, -1, -1,
+            nullptr, DoNothingBackprop, "NoOperand");
+    return v;
+}
+
+const Var no_operand(MakeNoOperand());
 void DoNothingBackprop(Var&, Var*, Var*) {}
 
-Var ComputationGraph::CreateParam(std::shared_ptr<Eigen::MatrixXd> val) {
-    int p_id = values_.size();
+static uint64_t NextEpoch() {
+    static std::atomic<uint64_t> next_epoch(0);
+    return ++next_epoch;
+}
+
+ComputationGraph::ComputationGraph() : epoch_(NextEpoch()) {}
+
+VarImpl* ComputationGraph::NewVar(
+        double* val,
+        int rows,
+        int cols,
+        bool requires_grad,
+        int lhs,
+        int rhs,
+        forward_t fwd,
+        backward_t bwd,
+        const char* op) {
+    if (size_ == values_.size()) {
+        values_.emplace_back(new VarImpl(this));
+    }
+
+    double* deriv = requires_grad ? Allocate(rows * cols, op) : nullptr;
+    VarImpl* v = values_[size_].get();
+    v->Init(val, deriv, rows, cols, size_, lhs, rhs, fwd, bwd, op);
+    ++size_;
+    return v;
+}
+
+double* ComputationGraph::Allocate(size_t n, const char* op) {
+    if (profiler_) {
+        profiler_->AddBytes(op, n * sizeof (double));
+    }
+    return arena_.Allocate(n);
+}
 
-    values_.emplace_back(
-            new VarImpl(this, val, p_id, -1, -1, DoNothingBackprop));
-    return Var(values_.back().get());
+Var ComputationGraph::CreateParam(std::shared_ptr<Eigen::MatrixXd> val) {
+    VarImpl* v = NewVar(val->data(), val->rows(), val->cols(), grad_enabled_,
+            -1, -1, nullptr, DoNothingBackprop, "Param");
+    v->SetParam(std::move(val));
+    return Var(v);
 }
 
 Var ComputationGraph::CreateParam(const Eigen::MatrixXd& val) {
-    return CreateParam(std::make_shared<Eigen::MatrixXd>(val));
+    Var v = CreateParam(val.rows(), val.cols());
+    v.value() = val;
+    return v;
+}
+
+Var ComputationGraph::CreateParam(int rows, int cols) {
+    Var v(NewVar(Allocate(rows * cols, "Param"), rows, cols, grad_enabled_,
+            -1, -1, nullptr, DoNothingBackprop, "Param"));
+    v.value().setZero();
+    return v;
+}
+
+Var ComputationGraph::CreateConstant(const Eigen::MatrixXd& val) {
+    Var v = CreateConstant(val.rows(), val.cols());
+    v.value() = val;
+    return v;
+}
+
+Var ComputationGraph::CreateConstant(int rows, int cols) {
+    Var v(NewVar(Allocate(rows * cols, "Constant"), rows, cols, false,
+            -1, -1, nullptr, DoNothingBackprop, "Constant"));
+    v.value().setZero();
+    return v;
+}
+
+Var ComputationGraph::CreateSparseConstant(
+        const Eigen::SparseMatrix<double>& val) {
+    Var v = CreateSparseConstant(val.rows(), val.cols());
+    v.sparse_value() = val;
+    return v;
+}
+
+Var ComputationGraph::CreateSparseConstant(int rows, int cols) {
+    VarImpl* v = NewVar(nullptr, 0, 0, false,
+            -1, -1, nullptr, DoNothingBackprop, "SparseConstant");
+    v->MakeSparse(rows, cols);
+    return Var(v);
+}
+
+Var ComputationGraph::CreateSparseGradParam(
+        std::shared_ptr<Eigen::MatrixXd> val) {
+    VarImpl* v = NewVar(val->data(), val->rows(), val->cols(), false,
+            -1, -1, nullptr, DoNothingBackprop, "SparseGradParam");
+    v->SetParam(std::move(val));
+    if (grad_enabled_) {
+        v->EnableSparseGrad();
+    }
+    return Var(v);
 }
 
 Var ComputationGraph::CreateNode(
         const Eigen::MatrixXd& val,
         const Var& lhs,
         const Var& rhs,
-        backward_t bwd) {
-    int p_id = values_.size();
+        backward_t bwd,
+        const char* op) {
+    bool requires_grad =
+        grad_enabled_ && (lhs.requires_grad() || rhs.requires_grad());
+    Var v(NewVar(Allocate(val.size(), op), val.rows(), val.cols(),
+            requires_grad, lhs.id(), rhs.id(), nullptr, bwd, op));
+    v.value() = val;
+    return v;
+}
+
+Var ComputationGraph::CreateNode(
+        int rows,
+        int cols,
+        const Var& lhs,
+        const Var& rhs,
+        forward_t fwd,
+        backward_t bwd,
+        const char* op) {
+    bool requires_grad =
+        grad_enabled_ && (lhs.requires_grad() || rhs.requires_grad());
+    Var v(NewVar(Allocate(rows * cols, op), rows, cols, requires_grad,
+            lhs.id(), rhs.id(), fwd, bwd, op));
+    Profiler::Time(profiler_, op, Profiler::kForward,
+            [&]() { fwd(v, &lhs, &rhs); });
+    return v;
+}
+
+Var ComputationGraph::CreateNode(
+        int rows,
+        int cols,
+        const Var& lhs,
+        const Var& rhs,
+        const Var& aux,
+        forward_t fwd,
+        backward_t bwd,
+        const char* op) {
+    bool requires_grad = grad_enabled_ && (lhs.requires_grad()
+            || rhs.requires_grad() || aux.requires_grad());
+    VarImpl* v = NewVar(Allocate(rows * cols, op), rows, cols,
+            requires_grad, lhs.id(), rhs.id(), fwd, bwd, op);
+    v->SetAux(aux.id());
+    Var res(v);
+    Profiler::Time(profiler_, op, Profiler::kForward,
+            [&]() { fwd(res, &lhs, &rhs); });
+    return res;
+}
 
-    values_.emplace_back(
-            new VarImpl(this, val, p_id, lhs.id(), rhs.id(), *bwd));
-    return Var(values_.back().get());
+void ComputationGraph::Forward() {
+    for (size_t i = 0; i < size_; ++i) {
+        VarImpl* cur = values_[i].get();
+        if (!cur->HasForward()) {
+            cur->SyncParam();
+            continue;
+        }
+
+        Var self(cur);
+        Var a(values_[cur->lhs()].get());
+        Var b(cur->rhs() == -1 ? no_operand : Var(values_[cur->rhs()].get()));
+        Profiler::Time(profiler_, cur->op(), Profiler::kForward,
+                [&]() { cur->Forward(self, &a, &b); });
+    }
 }
 
 void ComputationGraph::BackpropFrom(Var& x) {
+    if (!x.requires_grad()) {
+        return;
+    }
+
     int id = x.id();
+    assert(plan_root_ == -1 || plan_root_ == id);
     values_[id]->InitBackprop();
     for (int i = id; i >= 0; --i) {
         Var cur(values_[i].get());
-        Var nullvar(nullptr);
+        if (!cur.requires_grad()) {
+            // constant subgraph, nothing to propagate to
+            continue;
+        }
+
+        if (!clear_before_.empty()) {
+            // shared derivative buffers start their life here
+            for (int op : {i, cur.lhs(), cur.rhs(), cur.aux()}) {
+                if (op != -1 && op != id && clear_before_[op] == i) {
+                    values_[op]->derivative().setZero();
+                }
+            }
+        }
+
         if (cur.lhs() == -1) {
-            cur.Backward(nullptr, nullptr);
-        } else if (cur.rhs() == -1) {
-            Var a(values_[cur.lhs()].get());
-            cur.Backward(&a, nullptr);
-        } else {
-            Var a(values_[cur.lhs()].get());
-            Var b(values_[cur.rhs()].get());
-            cur.Backward(&a, &b);
+            // leaves have nothing to propagate to
+            continue;
         }
+
+        Var a(values_[cur.lhs()].get());
+        Profiler::Time(profiler_, cur.op(), Profiler::kBackward, [&]() {
+            if (cur.rhs() == -1) {
+                cur.Backward(&a, nullptr);
+            } else {
+                Var b(values_[cur.rhs()].get());
+                cur.Backward(&a, &b);
+            }
+        });
     }
 }
 
 void ComputationGraph::ClearGrad() {
-    for (auto& v : values_) {
-        v->ClearDerivative();
+    for (size_t i = 0; i < size_; ++i) {
+        // shared buffers may still hold a value, BackpropFrom() clears them
+        bool shared = i < clear_before_.size() && clear_before_[i] != -1;
+        if (values_[i]->requires_grad() && !shared) {
+            values_[i]->ClearDerivative();
+        }
     }
 }
 
 void ComputationGraph::Update(Optimizer& opt, const std::vector<Var*>& params) {
     for (auto& p : params) {
-        opt.Update(*p);
+        if (p->requires_grad()) {
+            opt.Update(*p);
+        }
+    }
+}
+
+void ComputationGraph::Update(
+        Optimizer& opt, std::initializer_list<Var*> params) {
+    for (auto& p : params) {
+        if (p->requires_grad()) {
+            opt.Update(*p);
+        }
+    }
+}
+
+void ComputationGraph::Reset() {
+    for (size_t i = 0; i < size_; ++i) {
+        values_[i]->Release();
+    }
+    size_ = 0;
+    arena_.Reset();
+    clear_before_.clear();
+    plan_root_ = -1;
+    epoch_ = NextEpoch();
+    epoch_token_.reset();
+}
+
+namespace {
+
+// A buffer to place, alive from step begin to step end included
+struct Lifetime {
+    int begin;
+    int end;
+    size_t size;
+    int node;
+    bool is_value;
+};
+
+} // anonymous
+
+MemoryPlan ComputationGraph::PlanMemory(
+        const Var& root, std::initializer_list<Var> keep) {
+    assert(clear_before_.empty());
+
+    // Step i is the forward of node i, step 2 * n - 1 - i its backward.
+    // Nodes after root are never backpropagated.
+    const int n = root.id() + 1;
+    const int kForever = 2 * n;
+    auto backward_step = [&](int i) { return 2 * n - 1 - i; };
+
+    std::vector<int> value_end(size_, -1);
+    std::vector<int> deriv_begin(size_, kForever);
+    for (size_t i = 0; i < size_; ++i) {
+        VarImpl* v = values_[i].get();
+        bool backward = (int)i < n && v->requires_grad();
+        if (backward) {
+            value_end[i] = backward_step(i);
+            deriv_begin[i] = backward_step(i);
+        }
+
+        // an operator reads the values of its operands in both passes, and
+        // accumulates into their derivatives in the backward one
+        for (int op : {v->lhs(), v->rhs(), v->aux()}) {
+            if (op == -1) {
+                continue;
+            }
+            value_end[op] = std::max(value_end[op], (int)i);
+            if (backward) {
+                value_end[op] = std::max(value_end[op], backward_step(i));
+                deriv_begin[op] = std::min(deriv_begin[op], backward_step(i));
+            }
+        }
+    }
+
+    std::vector<bool> kept(size_, false);
+    kept[root.id()] = true;
+    for (auto& k : keep) {
+        kept[k.id()] = true;
+    }
+
+    MemoryPlan plan = {0, 0};
+    std::vector<Lifetime> lifetimes;
+    std::vector<std::pair<VarImpl*, bool>> owned;
+    for (size_t i = 0; i < size_; ++i) {
+        VarImpl* v = values_[i].get();
+        size_t val_size = v->param() ? 0 : v->value().size();
+        if (val_size) {
+            plan.naive_bytes += val_size * sizeof (double);
+            // leaves are not recomputed by Forward()
+            if (v->HasForward() && (int)i < n && !kept[i]) {
+                lifetimes.push_back(Lifetime{(int)i,
+                        std::max(value_end[i], (int)i), val_size, (int)i, true});
+            } else {
+                owned.emplace_back(v, true);
+            }
+        }
+
+        size_t deriv_size = v->derivative().size();
+        if (v->requires_grad() && deriv_size) {
+            plan.naive_bytes += deriv_size * sizeof (double);
+            // the optimizer reads the derivatives of the leaves after
+            // BackpropFrom()
+            if (v->lhs() != -1 && (int)i < n) {
+                lifetimes.push_back(Lifetime{deriv_begin[i],
+                        backward_step(i), deriv_size, (int)i, false});
+            } else {
+                owned.emplace_back(v, false);
+            }
+        }
+    }
+
+    // Greedy placement in order of birth: a buffer takes the smallest free
+    // slot big enough, or grows the biggest free one.
+    std::sort(lifetimes.begin(), lifetimes.end(),
+            [](const Lifetime& a, const Lifetime& b) {
+                return a.begin < b.begin;
+            });
+    std::vector<size_t> slot_sizes;
+    std::vector<int> slot_of(lifetimes.size());
+    std::multimap<size_t, int> free_slots;
+    typedef std::pair<int, int> EndAndSlot;
+    std::priority_queue<EndAndSlot, std::vector<EndAndSlot>,
+        std::greater<EndAndSlot>> busy;
+    for (size_t l = 0; l < lifetimes.size(); ++l) {
+        const Lifetime& life = lifetimes[l];
+        while (!busy.empty() && busy.top().first < life.begin) {
+            int slot = busy.top().second;
+            free_slots.emplace(slot_sizes[slot], slot);
+            busy.pop();
+        }
+
+        int slot;
+        auto fit = free_slots.lower_bound(life.size);
+        if (fit == free_slots.end() && !free_slots.empty()) {
+            --fit;
+        }
+        if (fit != free_slots.end()) {
+            slot = fit->second;
+            free_slots.erase(fit);
+            slot_sizes[slot] = std::max(slot_sizes[slot], life.size);
+        } else {
+            slot = slot_sizes.size();
+            slot_sizes.push_back(life.size);
+        }
+        slot_of[l] = slot;
+        busy.emplace(life.end, slot);
+    }
+
+    // Moves every buffer to a new arena, copying the values that Forward()
+    // does not recompute
+    Arena planned;
+    for (auto& o : owned) {
+        VarImpl* v = o.first;
+        if (o.second) {
+            double* val = planned.Allocate(v->value().size());
+            Eigen::Map<Eigen::MatrixXd>(val, v->rows(), v->cols()) = v->value();
+            v->Rebind(val, nullptr);
+            plan.planned_bytes += v->value().size() * sizeof (double);
+        } else {
+            double* deriv = planned.Allocate(v->derivative().size());
+            v->Rebind(nullptr, deriv);
+            v->derivative().setZero();
+            plan.planned_bytes += v->derivative().size() * sizeof (double);
+        }
+    }
+
+    std::vector<double*> slots;
+    for (size_t sz : slot_sizes) {
+        slots.push_back(planned.Allocate(sz));
+        plan.planned_bytes += sz * sizeof (double);
+    }
+
+    clear_before_.assign(size_, -1);
+    for (size_t l = 0; l < lifetimes.size(); ++l) {
+        const Lifetime& life = lifetimes[l];
+        VarImpl* v = values_[life.node].get();
+        if (life.is_value) {
+            v->Rebind(slots[slot_of[l]], nullptr);
+        } else {
+            v->Rebind(nullptr, slots[slot_of[l]]);
+            clear_before_[life.node] = 2 * n - 1 - life.begin;
+        }
     }
+
+    arena_ = std::move(planned);
+    plan_root_ = root.id();
+    return plan;
 }
 
 } // ad
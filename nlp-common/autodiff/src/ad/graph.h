@@ -1,64 +1,176 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
 #include <list>
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
+#include "arena.h"
 #include "optimizer.h"
+#include "profiler.h"
+#include "sparse_grad.h"
 
 #include "Eigen/Dense"
+#include "Eigen/Sparse"
 
 namespace ad {
 
 class Var;
 class ComputationGraph;
 
+using forward_t = void(*)(Var&, const Var*, const Var*);
 using backward_t = void(*)(Var&, Var*, Var*);
 void DoNothingBackprop(Var&, Var*, Var*);
 
 class VarImpl {
     private:
-        std::shared_ptr<Eigen::MatrixXd> value_;
-        Eigen::MatrixXd derivative_;
+        // value_ and derivative_ point into the graph's arena, or into the
+        // matrix owned by param_ for shared parameters.
+        Eigen::Map<Eigen::MatrixXd> value_;
+        Eigen::Map<Eigen::MatrixXd> derivative_;
+        std::shared_ptr<Eigen::MatrixXd> param_;
+
+        // Sparse constants keep their value here, value_ is then empty.
+        Eigen::SparseMatrix<double> sparse_value_;
+        bool sparse_;
+
+        // Params multiplied by a sparse matrix can accumulate their gradient
+        // here instead of in derivative_, which is then empty.
+        SparseGrad sparse_grad_;
+        bool has_sparse_grad_;
 
         int lhs_;
         int rhs_;
+        // Third operand of fused operators, fetched from the graph by their
+        // forward and backward functions
+        int aux_;
         int id_;
 
+        // Only nodes leading to a trainable param get a derivative buffer and
+        // are visited by the backward pass.
+        bool requires_grad_;
+
+        // Null for leaves and for nodes whose value was computed outside of
+        // the graph: those are not recomputed when the graph is replayed.
+        forward_t forward_;
         backward_t backward_;
 
+        // Name of the operator, for the profiler
+        const char* op_;
+
         ComputationGraph* const graph_;
 
     public:
-        VarImpl(ComputationGraph* g,
-                std::shared_ptr<Eigen::MatrixXd> val,
+        VarImpl(ComputationGraph* g)
+            : value_(nullptr, 0, 0), derivative_(nullptr, 0, 0), sparse_(false),
+            has_sparse_grad_(false), lhs_(-1), rhs_(-1), aux_(-1), id_(-1),
+            requires_grad_(false), forward_(nullptr),
+            backward_(DoNothingBackprop), op_(""), graph_(g) {}
+
+        // Nodes are recycled by their graph, so they are (re)initialized
+        // here rather than in the constructor. A null deriv means that the
+        // node does not require a gradient.
+        void Init(double* val,
+                double* deriv,
+                int rows,
+                int cols,
                 int my_id,
                 int op1,
                 int op2,
-                const backward_t& bckwd)
-            : value_(val), derivative_(val->rows(), val->cols()), lhs_(op1),
-            rhs_(op2), id_(my_id), backward_(bckwd), graph_(g) {
-            derivative_.setZero();
+                forward_t fwd,
+                const backward_t& bckwd,
+                const char* op) {
+            new (&value_) Eigen::Map<Eigen::MatrixXd>(val, rows, cols);
+            requires_grad_ = deriv != nullptr;
+            if (requires_grad_) {
+                new (&derivative_) Eigen::Map<Eigen::MatrixXd>(deriv, rows, cols);
+                derivative_.setZero();
+            } else {
+                new (&derivative_) Eigen::Map<Eigen::MatrixXd>(nullptr, 0, 0);
+            }
+            param_.reset();
+            sparse_ = false;
+            has_sparse_grad_ = false;
+            id_ = my_id;
+            lhs_ = op1;
+            rhs_ = op2;
+            aux_ = -1;
+            forward_ = fwd;
+            backward_ = bckwd;
+            op_ = op;
         }
 
-        VarImpl(ComputationGraph* g,
-                const Eigen::MatrixXd& val,
-                int my_id,
-                int op1,
-                int op2,
-                const backward_t& bckwd)
-            : value_(std::make_shared<Eigen::MatrixXd>(val)),
-            derivative_(val.rows(), val.cols()), lhs_(op1),
-            rhs_(op2), id_(my_id), backward_(bckwd), graph_(g) {
-            derivative_.setZero();
+        // Moves value and derivative to other buffers, without copying
+        void Rebind(double* val, double* deriv) {
+            if (val) {
+                new (&value_) Eigen::Map<Eigen::MatrixXd>(
+                        val, value_.rows(), value_.cols());
+            }
+            if (deriv) {
+                new (&derivative_) Eigen::Map<Eigen::MatrixXd>(
+                        deriv, derivative_.rows(), derivative_.cols());
+            }
+        }
+
+        void SetParam(std::shared_ptr<Eigen::MatrixXd> p) { param_ = std::move(p); }
+        void SetAux(int aux) { aux_ = aux; }
+        void Release() { param_.reset(); }
+
+        // Turns this leaf into an all-zero sparse matrix. The storage of the
+        // sparse matrix is kept when the node is recycled.
+        void MakeSparse(int rows, int cols) {
+            sparse_ = true;
+            sparse_value_.resize(rows, cols);
+            sparse_value_.setZero();
         }
+
+        void EnableSparseGrad() {
+            has_sparse_grad_ = true;
+            requires_grad_ = true;
+            sparse_grad_.Init(value_.rows(), value_.cols());
+        }
+
+        // The param matrix may have been reallocated since the graph was
+        // built. Its dimensions must not have changed though.
+        void SyncParam() {
+            if (param_ && param_->data() != value_.data()) {
+                assert(param_->rows() == value_.rows());
+                assert(param_->cols() == value_.cols());
+                new (&value_) Eigen::Map<Eigen::MatrixXd>(
+                        param_->data(), param_->rows(), param_->cols());
+            }
+        }
+
         ComputationGraph* graph() const { return graph_; }
-        const Eigen::MatrixXd& value() const { return *value_;}
-        Eigen::MatrixXd& value() { return *value_;}
-        const Eigen::MatrixXd& derivative() const { return derivative_;}
-        Eigen::MatrixXd& derivative() { return derivative_;}
+        const std::shared_ptr<Eigen::MatrixXd>& param() const { return param_; }
+        const Eigen::Map<Eigen::MatrixXd>& value() const { return value_;}
+        Eigen::Map<Eigen::MatrixXd>& value() { return value_;}
+        const Eigen::Map<Eigen::MatrixXd>& derivative() const { return derivative_;}
+        Eigen::Map<Eigen::MatrixXd>& derivative() { return derivative_;}
+        const Eigen::SparseMatrix<double>& sparse_value() const { return sparse_value_; }
+        Eigen::SparseMatrix<double>& sparse_value() { return sparse_value_; }
+        const SparseGrad& sparse_grad() const { return sparse_grad_; }
+        SparseGrad& sparse_grad() { return sparse_grad_; }
 
-        void ClearDerivative() { derivative_.setZero(); }
+        int rows() const { return sparse_ ? sparse_value_.rows() : value_.rows(); }
+        int cols() const { return sparse_ ? sparse_value_.cols() : value_.cols(); }
+
+        void ClearDerivative() {
+            if (has_sparse_grad_) {
+                sparse_grad_.Clear();
+            } else {
+                derivative_.setZero();
+            }
+        }
+
+        bool HasForward() const { return forward_ != nullptr; }
+
+        void Forward(Var& self, const Var* lhs, const Var* rhs) {
+            forward_(self, lhs, rhs);
+        }
 
         void Backward(Var& self, Var* lhs, Var* rhs) {
             backward_(self, lhs, rhs);
@@ -67,8 +179,13 @@ class VarImpl {
         void InitBackprop() { derivative_.setOnes(); }
 
         int id() const { return id_; }
+        const char* op() const { return op_; }
         int lhs() const { return lhs_; }
         int rhs() const { return rhs_; }
+        int aux() const { return aux_; }
+        bool requires_grad() const { return requires_grad_; }
+        bool is_sparse() const { return sparse_; }
+        bool has_sparse_grad() const { return has_sparse_grad_; }
 };
 
 class Var {
@@ -76,36 +193,171 @@ class Var {
     public:
         Var(VarImpl* var) : var_(var) {}
         ComputationGraph* graph() const { return var_->graph(); }
-        const Eigen::MatrixXd& value() const { return var_->value();}
-        Eigen::MatrixXd& value() { return var_->value();}
-        const Eigen::MatrixXd& derivative() const { return var_->derivative();}
-        Eigen::MatrixXd& derivative() { return var_->derivative();}
+        // The shared matrix of params created from one, null otherwise
+        const std::shared_ptr<Eigen::MatrixXd>& param() const { return var_->param(); }
+        const Eigen::Map<Eigen::MatrixXd>& value() const { return var_->value();}
+        Eigen::Map<Eigen::MatrixXd>& value() { return var_->value();}
+        const Eigen::Map<Eigen::MatrixXd>& derivative() const { return var_->derivative();}
+        Eigen::Map<Eigen::MatrixXd>& derivative() { return var_->derivative();}
+        const Eigen::SparseMatrix<double>& sparse_value() const { return var_->sparse_value(); }
+        Eigen::SparseMatrix<double>& sparse_value() { return var_->sparse_value(); }
+        const SparseGrad& sparse_grad() const { return var_->sparse_grad(); }
+        SparseGrad& sparse_grad() { return var_->sparse_grad(); }
+        int rows() const { return var_->rows(); }
+        int cols() const { return var_->cols(); }
 
         void Backward(Var* lhs, Var* rhs) {
             var_->Backward(*this, lhs, rhs);
         }
         int id() const { return var_->id(); }
+        const char* op() const { return var_->op(); }
         int lhs() const { return var_->lhs(); }
         int rhs() const { return var_->rhs(); }
+        int aux() const { return var_->aux(); }
+        bool requires_grad() const { return var_->requires_grad(); }
+        bool is_sparse() const { return var_->is_sparse(); }
+        bool has_sparse_grad() const { return var_->has_sparse_grad(); }
 };
 
 extern const Var no_operand;
 
+// Bytes of the value and derivative buffers of a graph, all of them being
+// alive at the same time, before and after PlanMemory()
+struct MemoryPlan {
+    size_t naive_bytes;
+    size_t planned_bytes;
+};
+
+// Nodes and their buffers are owned by the graph. Reset() invalidates every
+// Var created so far but keeps the memory, so that a training loop can reuse
+// a single graph without allocating once it reached its steady state.
+//
+// A graph can also be captured once and replayed: write new values into its
+// constants, then Forward() recomputes every node in place, and ClearGrad()
+// followed by BackpropFrom() runs the backward pass again.
 class ComputationGraph {
     std::vector<std::unique_ptr<VarImpl>> values_;
+    size_t size_ = 0;
+    Arena arena_;
+    bool grad_enabled_ = true;
+
+    // Set by PlanMemory(): the derivative of node i lives in a shared buffer
+    // which is zeroed right before the backward of node clear_before_[i],
+    // or -1 if it has a buffer of its own.
+    std::vector<int> clear_before_;
+    int plan_root_ = -1;
+
+    Profiler* profiler_ = nullptr;
+
+    // Identifies the nodes created since the last Reset(): never shared by
+    // two graphs nor by two passes of one graph
+    uint64_t epoch_;
+    // Created on demand by epoch_token(), dropped with the epoch
+    mutable std::shared_ptr<const uint64_t> epoch_token_;
+
+    // Allocates from the arena on behalf of op
+    double* Allocate(size_t n, const char* op);
+
+    VarImpl* NewVar(
+            double* val,
+            int rows,
+            int cols,
+            bool requires_grad,
+            int lhs,
+            int rhs,
+            forward_t fwd,
+            backward_t bwd,
+            const char* op);
 
     public:
+    ComputationGraph();
+    ComputationGraph(const ComputationGraph&) = delete;
+    ComputationGraph& operator=(const ComputationGraph&) = delete;
+
     Var CreateParam(std::shared_ptr<Eigen::MatrixXd> val);
     Var CreateParam(const Eigen::MatrixXd& val);
+    // A zero-initialized param stored in the graph
+    Var CreateParam(int rows, int cols);
+    // Constants (inputs, targets, ...) never get a gradient
+    Var CreateConstant(const Eigen::MatrixXd& val);
+    Var CreateConstant(int rows, int cols);
+    // Sparse constants can only be consumed by the operators supporting them
+    // (operator* and Affine). The second one starts all-zero, fill it through
+    // sparse_value().
+    Var CreateSparseConstant(const Eigen::SparseMatrix<double>& val);
+    Var CreateSparseConstant(int rows, int cols);
+    // A param whose gradient is only kept for the columns (or rows) touched
+    // by a product with a sparse matrix. It has no dense derivative, so it
+    // must only be consumed by operators supporting sparse operands.
+    Var CreateSparseGradParam(std::shared_ptr<Eigen::MatrixXd> val);
+    // A node computed outside of the graph. It is not updated by Forward().
+    // op names the operator in the profiler.
     Var CreateNode(
             const Eigen::MatrixXd& val,
             const Var& lhs,
             const Var& rhs,
-            backward_t bwd);
+            backward_t bwd,
+            const char* op = "Node");
+    // Allocates a node and computes its value in place with fwd. The same
+    // function recomputes it when the graph is replayed.
+    Var CreateNode(
+            int rows,
+            int cols,
+            const Var& lhs,
+            const Var& rhs,
+            forward_t fwd,
+            backward_t bwd,
+            const char* op = "Node");
+    // Same, for fused operators taking a third operand
+    Var CreateNode(
+            int rows,
+            int cols,
+            const Var& lhs,
+            const Var& rhs,
+            const Var& aux,
+            forward_t fwd,
+            backward_t bwd,
+            const char* op = "Node");
+    Var GetVar(int id) { return Var(values_[id].get()); }
+    // Recomputes every node from the current values of the leaves
+    void Forward();
     void BackpropFrom(Var& x);
     void ClearGrad();
     void Update(Optimizer& opt, const std::vector<Var*>& params);
+    void Update(Optimizer& opt, std::initializer_list<Var*> params);
+    void Reset();
+
+    // Once the graph is complete, works out when every intermediate value
+    // and derivative is needed by Forward() and BackpropFrom(root), and
+    // lets the buffers whose lifetimes do not overlap share memory. Leaves,
+    // root and keep have buffers of their own: the other nodes' values are
+    // only meaningful during the passes. Call Forward() before reading any
+    // computed value again. The plan holds until Reset().
+    MemoryPlan PlanMemory(const Var& root, std::initializer_list<Var> keep = {});
+
+    // A param owned by the graph is identified by its id and the epoch. The
+    // epoch changes on Reset(), when the ids are reused for new nodes.
+    uint64_t epoch() const { return epoch_; }
+    // Expires with the epoch, on Reset() or when the graph is destroyed
+    std::weak_ptr<const uint64_t> epoch_token() const {
+        if (!epoch_token_) {
+            epoch_token_ = std::make_shared<const uint64_t>(epoch_);
+        }
+        return epoch_token_;
+    }
+
+    // The memory holding the values and derivatives of the nodes
+    const Arena& arena() const { return arena_; }
+
+    // When disabled, no node requires a gradient and no derivative is
+    // allocated: use it for inference.
+    void SetGradEnabled(bool enabled) { grad_enabled_ = enabled; }
+    bool grad_enabled() const { return grad_enabled_; }
+
+    // Times every forward and backward of the nodes, and counts the bytes
+    // they allocate, until set back to null. Off by default.
+    void SetProfiler(Profiler* profiler) { profiler_ = profiler; }
+    Profiler* profiler() const { return profiler_; }
 };
 
 }
-
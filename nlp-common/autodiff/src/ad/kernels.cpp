@@ -0,0 +1,115 @@
+#include "kernels.h"
+
+#ifndef AD_X86_KERNELS
+#include <cstdint>
+#include <cstring>
+
+#include "kernels_impl.h"
+#endif
+
+namespace ad {
+
+namespace kernels {
+
+#ifndef AD_X86_KERNELS
+
+namespace {
+
+// Same kernels one element at a time, for CPUs without a vectorized version
+struct Scalar {
+    typedef double D;
+    typedef uint64_t I;
+    typedef bool M;
+    static const int kLanes = 1;
+
+    static D Load(const double* p) { return *p; }
+    static void Store(double* p, D a) { *p = a; }
+    static D Set(double a) { return a; }
+
+    static D Add(D a, D b) { return a + b; }
+    static D Sub(D a, D b) { return a - b; }
+    static D Mul(D a, D b) { return a * b; }
+    static D Div(D a, D b) { return a / b; }
+    static D Fma(D a, D b, D c) { return a * b + c; }
+    static D Min(D a, D b) { return b < a ? b : a; }
+    static D Max(D a, D b) { return a < b ? b : a; }
+
+    static M Lt(D a, D b) { return a < b; }
+    static M Gt(D a, D b) { return a > b; }
+    static M Eq(D a, D b) { return a == b; }
+    static M IsNan(D a) { return a != a; }
+    static D Select(M m, D a, D b) { return m ? a : b; }
+
+    static I Bits(D a) { I i; std::memcpy(&i, &a, sizeof(i)); return i; }
+    static D FromBits(I a) { D d; std::memcpy(&d, &a, sizeof(d)); return d; }
+    static I SetI(long long a) { return a; }
+    static I AndI(I a, I b) { return a & b; }
+    static I OrI(I a, I b) { return a | b; }
+    static I Shl52(I a) { return a << 52; }
+    static I Shr52(I a) { return a >> 52; }
+
+    static double Sum(D a) { return a; }
+};
+
+const KernelTable kScalarKernels = MakeKernelTable<Scalar>("scalar");
+
+} // anonymous
+
+#endif
+
+std::vector<const KernelTable*> SupportedKernels() {
+    std::vector<const KernelTable*> res;
+#ifdef AD_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        res.push_back(&kSse2Kernels);
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        res.push_back(&kAvx2Kernels);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        res.push_back(&kAvx512Kernels);
+    }
+#else
+    res.push_back(&kScalarKernels);
+#endif
+    return res;
+}
+
+const KernelTable& Kernels() {
+    static const KernelTable* const best = SupportedKernels().back();
+    return *best;
+}
+
+void Exp(const double* x, double* y, int n) {
+    Kernels().exp(x, y, n);
+}
+
+void Log(const double* x, double* y, int n) {
+    Kernels().log(x, y, n);
+}
+
+void Sigmoid(const double* x, double* y, int n) {
+    Kernels().sigmoid(x, y, n);
+}
+
+double ExpShift(const double* x, double shift, double* y, int n) {
+    return Kernels().exp_shift(x, shift, y, n);
+}
+
+double SumExp(const double* x, double shift, int n) {
+    return Kernels().sum_exp(x, shift, n);
+}
+
+void AddScaledExp(const double* x, double shift, double a, double* y, int n) {
+    Kernels().add_scaled_exp(x, shift, a, y, n);
+}
+
+void MaxPlus(const double* x, double shift, double a,
+             double* best, double* arg, int n) {
+    Kernels().max_plus(x, shift, a, best, arg, n);
+}
+
+} // kernels
+
+} // ad
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+namespace ad {
+
+namespace kernels {
+
+// Vectorized elementwise functions used by the operators. The instruction set
+// (AVX-512, AVX2 or SSE2) is picked at runtime from what the CPU supports.
+//
+// exp and log are polynomial approximations, within a few ulps of libm over
+// the whole range of doubles. exp flushes results below DBL_MIN to zero. The
+// output may alias the input.
+
+// y = exp(x)
+void Exp(const double* x, double* y, int n);
+// y = log(x)
+void Log(const double* x, double* y, int n);
+// y = 1 / (1 + exp(-x))
+void Sigmoid(const double* x, double* y, int n);
+// y = exp(x - shift), returns sum(y)
+double ExpShift(const double* x, double shift, double* y, int n);
+// sum(exp(x - shift))
+double SumExp(const double* x, double shift, int n);
+// y += a * exp(x - shift)
+void AddScaledExp(const double* x, double shift, double a, double* y, int n);
+// Where x + shift > best: best = x + shift and arg = a. One step of a
+// max-product recurrence (Viterbi), arg being the argmax so far.
+void MaxPlus(const double* x, double shift, double a,
+             double* best, double* arg, int n);
+
+struct KernelTable {
+    const char* name;
+    void (*exp)(const double* x, double* y, int n);
+    void (*log)(const double* x, double* y, int n);
+    void (*sigmoid)(const double* x, double* y, int n);
+    double (*exp_shift)(const double* x, double shift, double* y, int n);
+    double (*sum_exp)(const double* x, double shift, int n);
+    void (*add_scaled_exp)(
+            const double* x, double shift, double a, double* y, int n);
+    void (*max_plus)(const double* x, double shift, double a,
+                     double* best, double* arg, int n);
+};
+
+// The implementation used by the functions above
+const KernelTable& Kernels();
+// Every implementation this CPU can run, the selected one last
+std::vector<const KernelTable*> SupportedKernels();
+
+#ifdef AD_X86_KERNELS
+extern const KernelTable kSse2Kernels;
+extern const KernelTable kAvx2Kernels;
+extern const KernelTable kAvx512Kernels;
+#endif
+
+} // kernels
+
+} // ad
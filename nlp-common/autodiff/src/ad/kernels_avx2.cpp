@@ -0,0 +1,57 @@
+#include <immintrin.h>
+
+#include "kernels_impl.h"
+
+namespace ad {
+
+namespace kernels {
+
+namespace {
+
+// Compiled with -mavx2 -mfma
+struct Avx2 {
+    typedef __m256d D;
+    typedef __m256i I;
+    typedef __m256d M;
+    static const int kLanes = 4;
+
+    static D Load(const double* p) { return _mm256_loadu_pd(p); }
+    static void Store(double* p, D a) { _mm256_storeu_pd(p, a); }
+    static D Set(double a) { return _mm256_set1_pd(a); }
+
+    static D Add(D a, D b) { return _mm256_add_pd(a, b); }
+    static D Sub(D a, D b) { return _mm256_sub_pd(a, b); }
+    static D Mul(D a, D b) { return _mm256_mul_pd(a, b); }
+    static D Div(D a, D b) { return _mm256_div_pd(a, b); }
+    static D Fma(D a, D b, D c) { return _mm256_fmadd_pd(a, b, c); }
+    static D Min(D a, D b) { return _mm256_min_pd(a, b); }
+    static D Max(D a, D b) { return _mm256_max_pd(a, b); }
+
+    static M Lt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static M Gt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static M Eq(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static M IsNan(D a) { return _mm256_cmp_pd(a, a, _CMP_UNORD_Q); }
+    static D Select(M m, D a, D b) { return _mm256_blendv_pd(b, a, m); }
+
+    static I Bits(D a) { return _mm256_castpd_si256(a); }
+    static D FromBits(I a) { return _mm256_castsi256_pd(a); }
+    static I SetI(long long a) { return _mm256_set1_epi64x(a); }
+    static I AndI(I a, I b) { return _mm256_and_si256(a, b); }
+    static I OrI(I a, I b) { return _mm256_or_si256(a, b); }
+    static I Shl52(I a) { return _mm256_slli_epi64(a, 52); }
+    static I Shr52(I a) { return _mm256_srli_epi64(a, 52); }
+
+    static double Sum(D a) {
+        __m128d s = _mm_add_pd(
+                _mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+};
+
+} // anonymous
+
+extern const KernelTable kAvx2Kernels = MakeKernelTable<Avx2>("avx2");
+
+} // kernels
+
+} // ad
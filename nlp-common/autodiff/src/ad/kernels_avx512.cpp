@@ -0,0 +1,60 @@
+// GCC's AVX-512 headers start some intrinsics from deliberately undefined
+// registers, which -Wall reports as uninitialized.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#include "kernels_impl.h"
+
+namespace ad {
+
+namespace kernels {
+
+namespace {
+
+// Compiled with -mavx512f
+struct Avx512 {
+    typedef __m512d D;
+    typedef __m512i I;
+    typedef __mmask8 M;
+    static const int kLanes = 8;
+
+    static D Load(const double* p) { return _mm512_loadu_pd(p); }
+    static void Store(double* p, D a) { _mm512_storeu_pd(p, a); }
+    static D Set(double a) { return _mm512_set1_pd(a); }
+
+    static D Add(D a, D b) { return _mm512_add_pd(a, b); }
+    static D Sub(D a, D b) { return _mm512_sub_pd(a, b); }
+    static D Mul(D a, D b) { return _mm512_mul_pd(a, b); }
+    static D Div(D a, D b) { return _mm512_div_pd(a, b); }
+    static D Fma(D a, D b, D c) { return _mm512_fmadd_pd(a, b, c); }
+    static D Min(D a, D b) { return _mm512_min_pd(a, b); }
+    static D Max(D a, D b) { return _mm512_max_pd(a, b); }
+
+    static M Lt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static M Gt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static M Eq(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    static M IsNan(D a) { return _mm512_cmp_pd_mask(a, a, _CMP_UNORD_Q); }
+    static D Select(M m, D a, D b) { return _mm512_mask_blend_pd(m, b, a); }
+
+    static I Bits(D a) { return _mm512_castpd_si512(a); }
+    static D FromBits(I a) { return _mm512_castsi512_pd(a); }
+    static I SetI(long long a) { return _mm512_set1_epi64(a); }
+    static I AndI(I a, I b) { return _mm512_and_si512(a, b); }
+    static I OrI(I a, I b) { return _mm512_or_si512(a, b); }
+    static I Shl52(I a) { return _mm512_slli_epi64(a, 52); }
+    static I Shr52(I a) { return _mm512_srli_epi64(a, 52); }
+
+    static double Sum(D a) { return _mm512_reduce_add_pd(a); }
+};
+
+} // anonymous
+
+extern const KernelTable kAvx512Kernels = MakeKernelTable<Avx512>("avx512");
+
+} // kernels
+
+} // ad
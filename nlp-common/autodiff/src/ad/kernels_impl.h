@@ -0,0 +1,260 @@
+#pragma once
+
+// Body of the elementwise kernels, shared by every instruction set. Each
+// kernels_<isa>.cpp includes it with its own compiler flags and instantiates
+// the kernels with a V struct wrapping its intrinsics:
+//
+//   D, I, M        vectors of doubles, of 64 bits integers, comparison masks
+//   kLanes         number of doubles in a D
+//   Load, Store, Set, Add, Sub, Mul, Div, Fma (a * b + c), Min, Max
+//   Lt, Gt, Eq, IsNan, Select (m ? a : b)
+//   Bits, FromBits, SetI, AndI, OrI, Shl52, Shr52, Sum
+//
+// Everything lives in an anonymous namespace: the instantiations of two
+// translation units compiled with different flags must never be merged.
+
+#include <cfloat>
+#include <limits>
+
+#include "kernels.h"
+
+namespace ad {
+
+namespace kernels {
+
+namespace {
+
+const double kInf = std::numeric_limits<double>::infinity();
+const double kNan = std::numeric_limits<double>::quiet_NaN();
+
+const double kLog2e = 1.44269504088896338700e+00;
+const double kLn2Hi = 6.93147180369123816490e-01;
+const double kLn2Lo = 1.90821492927058770002e-10;
+const double kSqrt2 = 1.41421356237309514547e+00;
+// Adding it rounds a double below 2^51 to an integer, stored in the low bits
+// of the mantissa.
+const double kRoundMagic = 0x1.8p52;
+
+const double kExpMax = 709.782712893383973096;
+const double kExpMin = -708.396418532264106224;
+
+// exp(x) = 2^n * exp(r), |r| <= ln(2) / 2. exp(r) is its Taylor series up to
+// r^13, whose remainder is below 2e-16 relative.
+template <class V>
+inline typename V::D ExpV(typename V::D x0) {
+    typedef typename V::D D;
+
+    D x = V::Min(V::Max(x0, V::Set(kExpMin)), V::Set(kExpMax));
+    D t = V::Fma(x, V::Set(kLog2e), V::Set(kRoundMagic));
+    D n = V::Sub(t, V::Set(kRoundMagic));
+    D r = V::Fma(n, V::Set(-kLn2Hi), x);
+    r = V::Fma(n, V::Set(-kLn2Lo), r);
+
+    D p = V::Set(1.0 / 6227020800.0);
+    p = V::Fma(p, r, V::Set(1.0 / 479001600.0));
+    p = V::Fma(p, r, V::Set(1.0 / 39916800.0));
+    p = V::Fma(p, r, V::Set(1.0 / 3628800.0));
+    p = V::Fma(p, r, V::Set(1.0 / 362880.0));
+    p = V::Fma(p, r, V::Set(1.0 / 40320.0));
+    p = V::Fma(p, r, V::Set(1.0 / 5040.0));
+    p = V::Fma(p, r, V::Set(1.0 / 720.0));
+    p = V::Fma(p, r, V::Set(1.0 / 120.0));
+    p = V::Fma(p, r, V::Set(1.0 / 24.0));
+    p = V::Fma(p, r, V::Set(1.0 / 6.0));
+    p = V::Fma(p, r, V::Set(0.5));
+    p = V::Fma(p, r, V::Set(1.0));
+    p = V::Fma(p, r, V::Set(1.0));
+
+    // 2^n does not fit in a double for n = 1024 (nor as a normal for
+    // n < -1022), so it is built as 2^(n -+ 1) * 2^(+-1).
+    auto positive = V::Gt(n, V::Set(0));
+    D off = V::Select(positive, V::Set(1), V::Set(-1));
+    D biased = V::Add(V::Sub(n, off), V::Set(1023 + kRoundMagic));
+    D scale = V::FromBits(V::Shl52(V::Bits(biased)));
+    D y = V::Mul(V::Mul(p, scale), V::Select(positive, V::Set(2), V::Set(0.5)));
+
+    y = V::Select(V::Gt(x0, V::Set(kExpMax)), V::Set(kInf), y);
+    y = V::Select(V::Lt(x0, V::Set(kExpMin)), V::Set(0), y);
+    return V::Select(V::IsNan(x0), x0, y);
+}
+
+// log(x) = e * ln(2) + log(m), sqrt(1/2) <= m < sqrt(2). With f = (m - 1) /
+// (m + 1), log(m) = 2 * atanh(f), whose series is cut after f^21: the
+// remainder is below 1e-18.
+template <class V>
+inline typename V::D LogV(typename V::D x0) {
+    typedef typename V::D D;
+
+    // subnormals are scaled up to get a normalized mantissa
+    auto subnormal = V::Lt(x0, V::Set(DBL_MIN));
+    D x = V::Select(subnormal, V::Mul(x0, V::Set(0x1p52)), x0);
+
+    auto bits = V::Bits(x);
+    D e = V::FromBits(V::OrI(V::Shr52(bits), V::Bits(V::Set(0x1p52))));
+    e = V::Sub(e, V::Set(0x1p52 + 1023));
+    e = V::Sub(e, V::Select(subnormal, V::Set(52), V::Set(0)));
+
+    D m = V::FromBits(V::OrI(
+                V::AndI(bits, V::SetI(0x000FFFFFFFFFFFFFLL)),
+                V::SetI(0x3FF0000000000000LL)));
+    auto big = V::Gt(m, V::Set(kSqrt2));
+    m = V::Select(big, V::Mul(m, V::Set(0.5)), m);
+    e = V::Select(big, V::Add(e, V::Set(1)), e);
+
+    D f = V::Div(V::Sub(m, V::Set(1)), V::Add(m, V::Set(1)));
+    D s = V::Mul(f, f);
+    D p = V::Set(1.0 / 21);
+    p = V::Fma(p, s, V::Set(1.0 / 19));
+    p = V::Fma(p, s, V::Set(1.0 / 17));
+    p = V::Fma(p, s, V::Set(1.0 / 15));
+    p = V::Fma(p, s, V::Set(1.0 / 13));
+    p = V::Fma(p, s, V::Set(1.0 / 11));
+    p = V::Fma(p, s, V::Set(1.0 / 9));
+    p = V::Fma(p, s, V::Set(1.0 / 7));
+    p = V::Fma(p, s, V::Set(1.0 / 5));
+    p = V::Fma(p, s, V::Set(1.0 / 3));
+    p = V::Fma(p, s, V::Set(1.0));
+    D log_m = V::Mul(V::Add(f, f), p);
+
+    D y = V::Fma(e, V::Set(kLn2Hi), V::Fma(e, V::Set(kLn2Lo), log_m));
+
+    y = V::Select(V::Eq(x0, V::Set(kInf)), x0, y);
+    y = V::Select(V::Eq(x0, V::Set(0)), V::Set(-kInf), y);
+    y = V::Select(V::Lt(x0, V::Set(0)), V::Set(kNan), y);
+    return V::Select(V::IsNan(x0), x0, y);
+}
+
+// Applies f to whole vectors, then to the remaining elements through a
+// padded buffer, so that the tail gets the same results as the rest.
+template <class V, class F>
+inline void Apply(const double* x, double* y, int n, double pad, F f) {
+    int i = 0;
+    for (; i + V::kLanes <= n; i += V::kLanes) {
+        V::Store(y + i, f(V::Load(x + i)));
+    }
+
+    if (i < n) {
+        double buf[V::kLanes];
+        for (int j = 0; j < V::kLanes; ++j) {
+            buf[j] = i + j < n ? x[i + j] : pad;
+        }
+        V::Store(buf, f(V::Load(buf)));
+        for (int j = 0; i + j < n; ++j) {
+            y[i + j] = buf[j];
+        }
+    }
+}
+
+template <class V>
+void ExpKernel(const double* x, double* y, int n) {
+    typedef typename V::D D;
+    Apply<V>(x, y, n, 0, [](D a) { return ExpV<V>(a); });
+}
+
+template <class V>
+void LogKernel(const double* x, double* y, int n) {
+    typedef typename V::D D;
+    Apply<V>(x, y, n, 1, [](D a) { return LogV<V>(a); });
+}
+
+template <class V>
+void SigmoidKernel(const double* x, double* y, int n) {
+    typedef typename V::D D;
+    Apply<V>(x, y, n, 0, [](D a) {
+        D e = ExpV<V>(V::Sub(V::Set(0), a));
+        return V::Div(V::Set(1), V::Add(V::Set(1), e));
+    });
+}
+
+template <class V>
+double ExpShiftKernel(const double* x, double shift, double* y, int n) {
+    typedef typename V::D D;
+    D total = V::Set(0);
+    // padded with -inf, whose exp is 0
+    Apply<V>(x, y, n, -kInf, [&](D a) {
+        D e = ExpV<V>(V::Sub(a, V::Set(shift)));
+        total = V::Add(total, e);
+        return e;
+    });
+    return V::Sum(total);
+}
+
+template <class V>
+double SumExpKernel(const double* x, double shift, int n) {
+    typedef typename V::D D;
+    D total = V::Set(0);
+    int i = 0;
+    for (; i + V::kLanes <= n; i += V::kLanes) {
+        total = V::Add(total, ExpV<V>(V::Sub(V::Load(x + i), V::Set(shift))));
+    }
+
+    if (i < n) {
+        double buf[V::kLanes];
+        for (int j = 0; j < V::kLanes; ++j) {
+            buf[j] = i + j < n ? x[i + j] : -kInf;
+        }
+        total = V::Add(total, ExpV<V>(V::Sub(V::Load(buf), V::Set(shift))));
+    }
+    return V::Sum(total);
+}
+
+template <class V>
+void AddScaledExpKernel(
+        const double* x, double shift, double a, double* y, int n) {
+    typedef typename V::D D;
+    int i = 0;
+    for (; i + V::kLanes <= n; i += V::kLanes) {
+        D e = ExpV<V>(V::Sub(V::Load(x + i), V::Set(shift)));
+        V::Store(y + i, V::Fma(V::Set(a), e, V::Load(y + i)));
+    }
+
+    if (i < n) {
+        double in[V::kLanes];
+        double out[V::kLanes];
+        for (int j = 0; j < V::kLanes; ++j) {
+            in[j] = i + j < n ? x[i + j] : -kInf;
+            out[j] = i + j < n ? y[i + j] : 0;
+        }
+        D e = ExpV<V>(V::Sub(V::Load(in), V::Set(shift)));
+        V::Store(out, V::Fma(V::Set(a), e, V::Load(out)));
+        for (int j = 0; i + j < n; ++j) {
+            y[i + j] = out[j];
+        }
+    }
+}
+
+template <class V>
+void MaxPlusKernel(const double* x, double shift, double a,
+                   double* best, double* arg, int n) {
+    typedef typename V::D D;
+    int i = 0;
+    for (; i + V::kLanes <= n; i += V::kLanes) {
+        D s = V::Add(V::Load(x + i), V::Set(shift));
+        D b = V::Load(best + i);
+        auto better = V::Gt(s, b);
+        V::Store(best + i, V::Select(better, s, b));
+        V::Store(arg + i, V::Select(better, V::Set(a), V::Load(arg + i)));
+    }
+
+    for (; i < n; ++i) {
+        double s = x[i] + shift;
+        if (s > best[i]) {
+            best[i] = s;
+            arg[i] = a;
+        }
+    }
+}
+
+// constexpr, so that the tables are initialized before any code runs
+template <class V>
+constexpr KernelTable MakeKernelTable(const char* name) {
+    return KernelTable{name, ExpKernel<V>, LogKernel<V>, SigmoidKernel<V>,
+        ExpShiftKernel<V>, SumExpKernel<V>, AddScaledExpKernel<V>,
+        MaxPlusKernel<V>};
+}
+
+} // anonymous
+
+} // kernels
+
+} // ad
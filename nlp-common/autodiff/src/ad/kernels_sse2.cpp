@@ -0,0 +1,56 @@
+#include <emmintrin.h>
+
+#include "kernels_impl.h"
+
+namespace ad {
+
+namespace kernels {
+
+namespace {
+
+struct Sse2 {
+    typedef __m128d D;
+    typedef __m128i I;
+    typedef __m128d M;
+    static const int kLanes = 2;
+
+    static D Load(const double* p) { return _mm_loadu_pd(p); }
+    static void Store(double* p, D a) { _mm_storeu_pd(p, a); }
+    static D Set(double a) { return _mm_set1_pd(a); }
+
+    static D Add(D a, D b) { return _mm_add_pd(a, b); }
+    static D Sub(D a, D b) { return _mm_sub_pd(a, b); }
+    static D Mul(D a, D b) { return _mm_mul_pd(a, b); }
+    static D Div(D a, D b) { return _mm_div_pd(a, b); }
+    static D Fma(D a, D b, D c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static D Min(D a, D b) { return _mm_min_pd(a, b); }
+    static D Max(D a, D b) { return _mm_max_pd(a, b); }
+
+    static M Lt(D a, D b) { return _mm_cmplt_pd(a, b); }
+    static M Gt(D a, D b) { return _mm_cmpgt_pd(a, b); }
+    static M Eq(D a, D b) { return _mm_cmpeq_pd(a, b); }
+    static M IsNan(D a) { return _mm_cmpunord_pd(a, a); }
+    static D Select(M m, D a, D b) {
+        return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b));
+    }
+
+    static I Bits(D a) { return _mm_castpd_si128(a); }
+    static D FromBits(I a) { return _mm_castsi128_pd(a); }
+    static I SetI(long long a) { return _mm_set1_epi64x(a); }
+    static I AndI(I a, I b) { return _mm_and_si128(a, b); }
+    static I OrI(I a, I b) { return _mm_or_si128(a, b); }
+    static I Shl52(I a) { return _mm_slli_epi64(a, 52); }
+    static I Shr52(I a) { return _mm_srli_epi64(a, 52); }
+
+    static double Sum(D a) {
+        return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+    }
+};
+
+} // anonymous
+
+extern const KernelTable kSse2Kernels = MakeKernelTable<Sse2>("sse2");
+
+} // kernels
+
+} // ad
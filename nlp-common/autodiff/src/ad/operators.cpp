@@ -1,52 +1,150 @@
+#include <algorithm>
 #include <cassert>
+#include <limits>
 
+#include "kernels.h"
 #include "operators.h"
 
 namespace ad {
 
+static void AddForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value() = lhs->value() + rhs->value();
+}
+
 static void AddBackprop(Var& val, Var* lhs, Var* rhs) {
-    lhs->derivative() += val.derivative();
-    rhs->derivative() += val.derivative();
+    if (lhs->requires_grad()) {
+        lhs->derivative() += val.derivative();
+    }
+    if (rhs->requires_grad()) {
+        rhs->derivative() += val.derivative();
+    }
 }
 
 Var operator+(const Var& v1, const Var& v2) {
-    return v1.graph()->CreateNode(v1.value() + v2.value(), v1, v2, AddBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, v2, AddForward, AddBackprop, "Add");
+}
+
+static void SubForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value() = lhs->value() - rhs->value();
 }
 
 static void SubBackprop(Var& val, Var* lhs, Var* rhs) {
-    lhs->derivative() += val.derivative();
-    rhs->derivative() -= val.derivative();
+    if (lhs->requires_grad()) {
+        lhs->derivative() += val.derivative();
+    }
+    if (rhs->requires_grad()) {
+        rhs->derivative() -= val.derivative();
+    }
 }
 
 Var operator-(const Var& v1, const Var& v2) {
-    return v1.graph()->CreateNode(v1.value() - v2.value(), v1, v2, SubBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, v2, SubForward, SubBackprop, "Sub");
+}
+
+static void MulForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value().noalias() = lhs->value() * rhs->value();
 }
 
 static void MulBackprop(Var& val, Var* lhs, Var* rhs) {
-    lhs->derivative() +=  val.derivative() * rhs->value().transpose();
-    rhs->derivative() +=  lhs->value().transpose() * val.derivative();
+    if (lhs->requires_grad()) {
+        lhs->derivative().noalias() +=  val.derivative() * rhs->value().transpose();
+    }
+    if (rhs->requires_grad()) {
+        rhs->derivative().noalias() +=  lhs->value().transpose() * val.derivative();
+    }
+}
+
+// dw += dy * x^T for a sparse x: only the columns of w matching a non-zero
+// row of x are touched.
+static void DenseSparseMulGrad(Var& w,
+        const Eigen::Map<Eigen::MatrixXd>& dy,
+        const Eigen::SparseMatrix<double>& x) {
+    for (int c = 0; c < x.outerSize(); ++c) {
+        for (Eigen::SparseMatrix<double>::InnerIterator it(x, c); it; ++it) {
+            if (w.has_sparse_grad()) {
+                w.sparse_grad().Slice(SparseGrad::kCols, it.row())
+                    += it.value() * dy.col(c);
+            } else {
+                w.derivative().col(it.row()) += it.value() * dy.col(c);
+            }
+        }
+    }
+}
+
+// dw += x^T * dy for a sparse x: only the rows of w matching a non-zero
+// column of x are touched.
+static void SparseDenseMulGrad(Var& w,
+        const Eigen::Map<Eigen::MatrixXd>& dy,
+        const Eigen::SparseMatrix<double>& x) {
+    for (int c = 0; c < x.outerSize(); ++c) {
+        for (Eigen::SparseMatrix<double>::InnerIterator it(x, c); it; ++it) {
+            if (w.has_sparse_grad()) {
+                w.sparse_grad().Slice(SparseGrad::kRows, c)
+                    += it.value() * dy.row(it.row()).transpose();
+            } else {
+                w.derivative().row(c) += it.value() * dy.row(it.row());
+            }
+        }
+    }
+}
+
+// Sparse operands are constants: only the dense one may need a gradient
+static void DenseSparseMulForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value().noalias() = lhs->value() * rhs->sparse_value();
+}
+
+static void DenseSparseMulBackprop(Var& val, Var* lhs, Var* rhs) {
+    DenseSparseMulGrad(*lhs, val.derivative(), rhs->sparse_value());
+}
+
+static void SparseDenseMulForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value().noalias() = lhs->sparse_value() * rhs->value();
+}
+
+static void SparseDenseMulBackprop(Var& val, Var* lhs, Var* rhs) {
+    SparseDenseMulGrad(*rhs, val.derivative(), lhs->sparse_value());
 }
 
 Var operator*(const Var& v1, const Var& v2) {
-    return v1.graph()->CreateNode(v1.value() * v2.value(), v1, v2, MulBackprop);
+    assert(!(v1.is_sparse() && v2.is_sparse()));
+    if (v2.is_sparse()) {
+        return v1.graph()->CreateNode(v1.rows(), v2.cols(),
+                v1, v2, DenseSparseMulForward, DenseSparseMulBackprop,
+                "DenseSparseMul");
+    }
+    if (v1.is_sparse()) {
+        return v1.graph()->CreateNode(v1.rows(), v2.cols(),
+                v1, v2, SparseDenseMulForward, SparseDenseMulBackprop,
+                "SparseDenseMul");
+    }
+    return v1.graph()->CreateNode(v1.value().rows(), v2.value().cols(),
+            v1, v2, MulForward, MulBackprop, "Mul");
+}
+
+static void CoeffMulForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value() = lhs->value() * rhs->value()(0, 0);
 }
 
+// The coefficient is a constant: only lhs needs a gradient
 static void CoeffMulBackprop(Var& val, Var* lhs, Var* rhs) {
     lhs->derivative() +=  val.derivative() * rhs->value()(0, 0);
 }
 
 Var operator*(double a, const Var& v1) {
-    Eigen::MatrixXd coeff(1, 1);
-    coeff << a;
-    Var coeff_var = v1.graph()->CreateParam(coeff);
-    return v1.graph()->CreateNode(v1.value() * a, v1, coeff_var, CoeffMulBackprop);
+    Var coeff_var = v1.graph()->CreateConstant(1, 1);
+    coeff_var.value()(0, 0) = a;
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, coeff_var, CoeffMulForward, CoeffMulBackprop, "CoeffMul");
 }
 
 Var operator*(const Var& v1, double a) {
-    Eigen::MatrixXd coeff(1, 1);
-    coeff << a;
-    Var coeff_var = v1.graph()->CreateParam(coeff);
-    return v1.graph()->CreateNode(v1.value() * a, v1, coeff_var, CoeffMulBackprop);
+    return a * v1;
+}
+
+static void ReluForward(Var& val, const Var* lhs, const Var*) {
+    val.value().array() = lhs->value().array().max(0);
 }
 
 static void ReluBackprop(Var& val, Var* lhs, Var*) {
@@ -59,17 +157,27 @@ static void ReluBackprop(Var& val, Var* lhs, Var*) {
 }
 
 Var Relu(const Var& v1) {
-    return v1.graph()->CreateNode(
-            v1.value().array().max(0), v1, no_operand, ReluBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, no_operand, ReluForward, ReluBackprop, "Relu");
 }
 
+static void SquareForward(Var& val, const Var* lhs, const Var*) {
+    val.value().noalias() = lhs->value() * lhs->value();
+}
+
+// d(A * A) = dA * A + A * dA
 static void SquareBackprop(Var& val, Var* lhs, Var*) {
-    lhs->derivative() += 2 * val.derivative() * lhs->value();
+    lhs->derivative().noalias() += val.derivative() * lhs->value().transpose();
+    lhs->derivative().noalias() += lhs->value().transpose() * val.derivative();
 }
 
 Var Square(const Var& v1) {
-    return v1.graph()->CreateNode(
-            v1.value() * v1.value(), v1, no_operand, SquareBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, no_operand, SquareForward, SquareBackprop, "Square");
+}
+
+static void EltSquareForward(Var& val, const Var* lhs, const Var*) {
+    val.value() = lhs->value().cwiseProduct(lhs->value());
 }
 
 static void EltSquareBackprop(Var& val, Var* lhs, Var*) {
@@ -77,113 +185,216 @@ static void EltSquareBackprop(Var& val, Var* lhs, Var*) {
 }
 
 Var EltSquare(const Var& v1) {
-    return v1.graph()->CreateNode(
-            v1.value().cwiseProduct(v1.value()), v1, no_operand, EltSquareBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, no_operand, EltSquareForward, EltSquareBackprop, "EltSquare");
+}
+
+static void EltwiseMulForward(Var& val, const Var* lhs, const Var* rhs) {
+    val.value() = lhs->value().cwiseProduct(rhs->value());
 }
 
 static void EltwiseMulBackprop(Var& val, Var* lhs, Var* rhs) {
-    lhs->derivative() += val.derivative().cwiseProduct(rhs->value());
-    rhs->derivative() += val.derivative().cwiseProduct(lhs->value());
+    if (lhs->requires_grad()) {
+        lhs->derivative() += val.derivative().cwiseProduct(rhs->value());
+    }
+    if (rhs->requires_grad()) {
+        rhs->derivative() += val.derivative().cwiseProduct(lhs->value());
+    }
 }
 
 Var operator^(const Var& v1, const Var& v2) {
-    return v1.graph()->CreateNode(
-            v1.value().cwiseProduct(v2.value()), v1, v2, EltwiseMulBackprop);
+    return v1.graph()->CreateNode(v1.value().rows(), v1.value().cols(),
+            v1, v2, EltwiseMulForward, EltwiseMulBackprop, "EltwiseMul");
+}
+
+static void LogForward(Var& val, const Var* lhs, const Var*) {
+    kernels::Log(lhs->value().data(), val.value().data(), val.value().size());
 }
 
 static void LogBackprop(Var& val, Var* lhs, Var*) {
-    double* da = lhs->derivative().data();
-    double* dx = val.derivative().data();
-    const double* a = lhs->value().data();
-    for (int i = 0; i < val.value().size(); ++i) {
-        da[i] += dx[i] / a[i];
-    }
+    lhs->derivative().array() += val.derivative().array() / lhs->value().array();
 }
 
 Var Log(const Var& x) {
-    Eigen::MatrixXd res(x.value().rows(), x.value().cols());
-    double* dst_ptr = res.data();
-    const double* src_ptr = x.value().data();
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] = log(src_ptr[i]);
-    }
-    return x.graph()->CreateNode(res, x, no_operand, LogBackprop);
+    return x.graph()->CreateNode(x.value().rows(), x.value().cols(),
+            x, no_operand, LogForward, LogBackprop, "Log");
+}
+
+static void NLogForward(Var& val, const Var* lhs, const Var*) {
+    kernels::Log(lhs->value().data(), val.value().data(), val.value().size());
+    val.value() = -val.value();
 }
 
 static void NLogBackprop(Var& val, Var* lhs, Var*) {
-    double* da = lhs->derivative().data();
-    double* dx = val.derivative().data();
-    const double* a = lhs->value().data();
-    for (int i = 0, size = val.value().size(); i < size; ++i) {
-        da[i] += -dx[i] / (a[i]);
-    }
+    lhs->derivative().array() -= val.derivative().array() / lhs->value().array();
 }
 
 Var NLog(const Var& x) {
-    Eigen::MatrixXd res(x.value().rows(), x.value().cols());
-    double* dst_ptr = res.data();
-    const double* src_ptr = x.value().data();
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] = -log(src_ptr[i]);
-    }
-    return x.graph()->CreateNode(res, x, no_operand, NLogBackprop);
+    return x.graph()->CreateNode(x.value().rows(), x.value().cols(),
+            x, no_operand, NLogForward, NLogBackprop, "NLog");
 }
 
 Var CrossEntropy(const Var& y, const Var& h) {
     return Sum(y ^ NLog(h));
 }
 
+static void ExpForward(Var& val, const Var* lhs, const Var*) {
+    kernels::Exp(lhs->value().data(), val.value().data(), val.value().size());
+}
+
+// exp(a) is the value of the node itself
 static void ExpBackprop(Var& val, Var* lhs, Var*) {
-    double* da = lhs->derivative().data();
-    const double* dx = val.derivative().data();
-    const double* a = lhs->value().data();
-    for (int i = 0; i < val.value().size(); ++i) {
-        da[i] += dx[i] * exp(a[i]);
-    }
+    lhs->derivative() += val.derivative().cwiseProduct(val.value());
 }
 
 Var Exp(const Var& x) {
-    Eigen::MatrixXd res(x.value().rows(), x.value().cols());
-    double* dst_ptr = res.data();
-    const double* src_ptr = x.value().data();
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] = exp(src_ptr[i]);
+    return x.graph()->CreateNode(x.value().rows(), x.value().cols(),
+            x, no_operand, ExpForward, ExpBackprop, "Exp");
+}
+
+// Shifted by the max so that large scores do not overflow
+static void SoftmaxForward(Var& val, const Var* lhs, const Var*) {
+    if (val.value().size() == 0) {
+        return;
     }
-    return x.graph()->CreateNode(res, x, no_operand, ExpBackprop);
+
+    double max = lhs->value().maxCoeff();
+    double total = kernels::ExpShift(lhs->value().data(), max,
+            val.value().data(), val.value().size());
+    val.value() *= 1 / total;
 }
 
+// Full jacobian: dx_i = s_i * (ds_i - sum_j ds_j * s_j)
 static void SoftmaxBackprop(Var& val, Var* lhs, Var*) {
-    const Eigen::MatrixXd& a = val.value();
+    const auto& s = val.value();
+    const auto& ds = val.derivative();
+    double dot = ds.cwiseProduct(s).sum();
+    lhs->derivative().array() += s.array() * (ds.array() - dot);
+}
+
+Var Softmax(const Var& x) {
+    return x.graph()->CreateNode(x.value().rows(), x.value().cols(),
+            x, no_operand, SoftmaxForward, SoftmaxBackprop, "Softmax");
+}
+
+static void SigmoidForward(Var& val, const Var* lhs, const Var*) {
+    kernels::Sigmoid(lhs->value().data(), val.value().data(),
+            val.value().size());
+}
+
+static void SigmoidBackprop(Var& val, Var* lhs, Var*) {
+    const auto& a = val.value();
     lhs->derivative() += val.derivative()
         .cwiseProduct((a.array() * (1.0 - a.array())).matrix());
 }
 
-Var Softmax(const Var& x) {
-    Eigen::MatrixXd res(x.value().rows(), x.value().cols());
-    double* dst_ptr = res.data();
-    const double* src_ptr = x.value().data();
-    double total = 0;
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] = exp(src_ptr[i]);
-        total += dst_ptr[i];
+Var Sigmoid(const Var& x) {
+    return x.graph()->CreateNode(x.value().rows(), x.value().cols(),
+            x, no_operand, SigmoidForward, SigmoidBackprop, "Sigmoid");
+}
+
+// log(sum(exp(x))) of a column, shifted by its max
+static double LogSumExp(const double* x, int size) {
+    if (size == 0) {
+        return -std::numeric_limits<double>::infinity();
     }
 
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] /= total;
+    double max = x[0];
+    for (int i = 1; i < size; ++i) {
+        max = std::max(max, x[i]);
+    }
+    return max + log(kernels::SumExp(x, max, size));
+}
+
+// lhs: targets, rhs: logits
+static void SoftmaxCrossEntropyForward(Var& val, const Var* lhs, const Var* rhs) {
+    const auto& y = lhs->value();
+    const auto& x = rhs->value();
+    double loss = 0;
+    for (int col = 0; col < x.cols(); ++col) {
+        double lse = LogSumExp(x.data() + col * x.rows(), x.rows());
+        for (int i = 0; i < x.rows(); ++i) {
+            loss += y(i, col) * (lse - x(i, col));
+        }
+    }
+    val.value()(0, 0) = loss;
+}
+
+static void SoftmaxCrossEntropyBackprop(Var& val, Var* lhs, Var* rhs) {
+    const auto& y = lhs->value();
+    const auto& x = rhs->value();
+    double dloss = val.derivative()(0, 0);
+    for (int col = 0; col < x.cols(); ++col) {
+        double lse = LogSumExp(x.data() + col * x.rows(), x.rows());
+
+        if (rhs->requires_grad()) {
+            double y_total = y.col(col).sum();
+            rhs->derivative().col(col) -= dloss * y.col(col);
+            kernels::AddScaledExp(x.data() + col * x.rows(), lse,
+                    dloss * y_total, rhs->derivative().data() + col * x.rows(),
+                    x.rows());
+        }
+
+        if (lhs->requires_grad()) {
+            lhs->derivative().col(col).array() +=
+                dloss * (lse - x.col(col).array());
+        }
     }
-    return x.graph()->CreateNode(res, x, no_operand, SoftmaxBackprop);
 }
 
-Var Sigmoid(const Var& x) {
-    Eigen::MatrixXd res(x.value().rows(), x.value().cols());
-    double* dst_ptr = res.data();
-    const double* src_ptr = x.value().data();
-    for (int i = 0; i < res.size(); ++i) {
-        dst_ptr[i] = 1.0 / (1 + exp(-src_ptr[i]));
+Var SoftmaxCrossEntropy(const Var& y, const Var& x) {
+    return x.graph()->CreateNode(1, 1, y, x,
+            SoftmaxCrossEntropyForward, SoftmaxCrossEntropyBackprop,
+            "SoftmaxCrossEntropy");
+}
+
+// lhs: w, rhs: x, aux: b
+static void AffineForward(Var& val, const Var* lhs, const Var* rhs) {
+    Var b = val.graph()->GetVar(val.aux());
+    val.value().noalias() = lhs->value() * rhs->value();
+    val.value().colwise() += b.value().col(0);
+}
+
+static void AffineBackprop(Var& val, Var* lhs, Var* rhs) {
+    Var b = val.graph()->GetVar(val.aux());
+    if (lhs->requires_grad()) {
+        lhs->derivative().noalias() += val.derivative() * rhs->value().transpose();
     }
+    if (rhs->requires_grad()) {
+        rhs->derivative().noalias() += lhs->value().transpose() * val.derivative();
+    }
+    if (b.requires_grad()) {
+        b.derivative() += val.derivative().rowwise().sum();
+    }
+}
 
-    // Sigmoid derivative is the same as Softmax's
-    return x.graph()->CreateNode(res, x, no_operand, SoftmaxBackprop);
+static void SparseAffineForward(Var& val, const Var* lhs, const Var* rhs) {
+    Var b = val.graph()->GetVar(val.aux());
+    val.value().noalias() = lhs->value() * rhs->sparse_value();
+    val.value().colwise() += b.value().col(0);
+}
+
+static void SparseAffineBackprop(Var& val, Var* lhs, Var* rhs) {
+    Var b = val.graph()->GetVar(val.aux());
+    if (lhs->requires_grad()) {
+        DenseSparseMulGrad(*lhs, val.derivative(), rhs->sparse_value());
+    }
+    if (b.requires_grad()) {
+        b.derivative() += val.derivative().rowwise().sum();
+    }
+}
+
+Var Affine(const Var& w, const Var& x, const Var& b) {
+    if (x.is_sparse()) {
+        return w.graph()->CreateNode(w.rows(), x.cols(), w, x, b,
+                SparseAffineForward, SparseAffineBackprop, "SparseAffine");
+    }
+    return w.graph()->CreateNode(w.value().rows(), x.value().cols(), w, x, b,
+            AffineForward, AffineBackprop, "Affine");
+}
+
+static void SumForward(Var& val, const Var* lhs, const Var*) {
+    val.value()(0, 0) = lhs->value().sum();
 }
 
 void SumBackprop(Var& val, Var* lhs, Var*) {
@@ -191,20 +402,22 @@ void SumBackprop(Var& val, Var* lhs, Var*) {
 }
 
 Var Sum(const Var& a) {
-    Eigen::MatrixXd res(1, 1);
-    res << a.value().sum();
-    return a.graph()->CreateNode(res, a, no_operand, SumBackprop);
+    return a.graph()->CreateNode(1, 1, a, no_operand,
+            SumForward, SumBackprop, "Sum");
+}
+
+static void MeanForward(Var& val, const Var* lhs, const Var*) {
+    val.value()(0, 0) = lhs->value().sum() / lhs->value().size();
 }
 
 void MeanBackprop(Var& val, Var* lhs, Var*) {
     lhs->derivative().array() +=
-        (double)val.derivative()(0, 0) / val.value().size();
+        (double)val.derivative()(0, 0) / lhs->value().size();
 }
 
 Var Mean(const Var& a) {
-    Eigen::MatrixXd res(1, 1);
-    res << a.value().sum() / a.value().size();
-    return a.graph()->CreateNode(res, a, no_operand, MeanBackprop);
+    return a.graph()->CreateNode(1, 1, a, no_operand,
+            MeanForward, MeanBackprop, "Mean");
 }
 
 Var MSE(const Var& h, const Var& y) {
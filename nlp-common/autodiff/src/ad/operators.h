@@ -8,6 +8,8 @@ namespace ad {
 
 Var operator+(const Var& v1, const Var& v2);
 Var operator-(const Var& v1, const Var& v2);
+// One operand may be a sparse constant. The gradient of the dense one then
+// only touches its columns (or rows) matching the non-zeros of the other.
 Var operator*(const Var& v1, const Var& v2);
 Var operator*(double a, const Var& v2);
 Var operator*(const Var& v1, double a);
@@ -18,11 +20,18 @@ Var operator^(const Var& v1, const Var& v2);
 Var Log(const Var& x);
 Var NLog(const Var& x);
 Var CrossEntropy(const Var& y, const Var& h);
+// -sum(y * log(softmax(x))) computed from the logits x, column by column.
+// More stable than CrossEntropy(y, Softmax(x)), with the exact gradient
+// softmax(x) - y.
+Var SoftmaxCrossEntropy(const Var& y, const Var& x);
 Var Exp(const Var& x);
 Var Softmax(const Var& x);
 Var Sigmoid(const Var& x);
 Var Sum(const Var& a);
 Var Mean(const Var& a);
 Var MSE(const Var& h, const Var& y);
+// w * x + b in a single node, b being broadcast over the columns of x.
+// x may be a sparse constant.
+Var Affine(const Var& w, const Var& x, const Var& b);
 
 }
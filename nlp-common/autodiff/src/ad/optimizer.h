@@ -1,13 +1,22 @@
 #pragma once
 
+#include <memory>
+
+#include "Eigen/Core"
+
 namespace ad {
 
 class Var;
 
 class Optimizer {
     public:
+        virtual ~Optimizer() {}
         virtual void Update(Var& v) = 0;
         virtual void NextIteration() {}
+        // param replaces old, of which it is a grown copy: the state kept
+        // for old carries over to it
+        virtual void MoveState(const Eigen::MatrixXd& /* old */,
+                std::shared_ptr<Eigen::MatrixXd> /* param */) {}
 };
 
 }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../optimizer.h"
+#include "param_state.h"
+
+namespace ad {
+
+namespace opt {
+
+// Per coordinate step alpha / sqrt(sum of the squared gradients so far):
+// rare features, like rare words, keep large steps.
+class Adagrad : public ad::Optimizer {
+    public:
+        Adagrad(float alpha, float epsilon = 1e-8)
+            : alpha_(alpha), epsilon_(epsilon), state_(1) {}
+
+        virtual void Update(ad::Var& v) {
+            auto& sum_sq = state_.Get(v).buffers[0];
+            ForEachSlice(v, [&](auto&& w, const auto& g, auto slice) {
+                auto&& acc = slice(sum_sq);
+                acc.array() += g.array().square();
+                w.array() -= alpha_ * g.array() / (acc.array().sqrt() + epsilon_);
+            });
+        }
+
+        virtual void MoveState(const Eigen::MatrixXd& old,
+                std::shared_ptr<Eigen::MatrixXd> param) {
+            state_.Move(old, param);
+        }
+
+    private:
+        float alpha_;
+        float epsilon_;
+        ParamState state_;
+};
+
+} // opt
+
+} // ad
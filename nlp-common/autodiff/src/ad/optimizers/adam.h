@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cmath>
+
+#include "../optimizer.h"
+#include "param_state.h"
+
+namespace ad {
+
+namespace opt {
+
+// Adam, with bias-corrected first and second moments of the gradient. With a
+// sparse gradient, only the moments of the touched columns (or rows) are
+// updated ("lazy" Adam); the bias correction counts the updates of the param.
+class Adam : public ad::Optimizer {
+    public:
+        Adam(float alpha = 0.001, float beta1 = 0.9, float beta2 = 0.999,
+                float epsilon = 1e-8)
+            : alpha_(alpha), beta1_(beta1), beta2_(beta2), epsilon_(epsilon),
+            state_(2) {}
+
+        virtual void Update(ad::Var& v) {
+            auto& slot = state_.Get(v);
+            auto& mean = slot.buffers[0];
+            auto& var = slot.buffers[1];
+            ++slot.steps;
+            double step = alpha_ * std::sqrt(1 - std::pow(beta2_, slot.steps))
+                / (1 - std::pow(beta1_, slot.steps));
+
+            ForEachSlice(v, [&](auto&& w, const auto& g, auto slice) {
+                auto&& m = slice(mean);
+                auto&& s = slice(var);
+                m = beta1_ * m + (1 - beta1_) * g;
+                s.array() = beta2_ * s.array() + (1 - beta2_) * g.array().square();
+                w.array() -= step * m.array() / (s.array().sqrt() + epsilon_);
+            });
+        }
+
+        virtual void MoveState(const Eigen::MatrixXd& old,
+                std::shared_ptr<Eigen::MatrixXd> param) {
+            state_.Move(old, param);
+        }
+
+    private:
+        float alpha_;
+        float beta1_;
+        float beta2_;
+        float epsilon_;
+        ParamState state_;
+};
+
+} // opt
+
+} // ad
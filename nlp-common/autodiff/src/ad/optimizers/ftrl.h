@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cmath>
+
+#include "../optimizer.h"
+#include "param_state.h"
+
+namespace ad {
+
+namespace opt {
+
+// FTRL-Proximal (McMahan et al., 2013), meant for online learning: per
+// coordinate adaptive steps like Adagrad, and an L1 term setting rarely useful
+// weights to exactly zero. The weights are a function of the accumulated z
+// and n: coordinates seen for the first time are warm-started from their
+// current value, so that the optimizer can take over an already trained
+// model.
+class FTRL : public ad::Optimizer {
+    public:
+        FTRL(float alpha, float beta = 1, float l1 = 0, float l2 = 0)
+            : alpha_(alpha), beta_(beta), l1_(l1), l2_(l2), state_(2) {}
+
+        virtual void Update(ad::Var& v) {
+            auto& slot = state_.Get(v);
+            auto& z_buf = slot.buffers[0];
+            auto& n_buf = slot.buffers[1];
+
+            ForEachSlice(v, [&](auto&& w, const auto& g, auto slice) {
+                auto&& z = slice(z_buf).array();
+                auto&& n = slice(n_buf).array();
+
+                // z such that the closed form below gives back w
+                z = (n == 0).select(
+                        -w.array() * (beta_ / alpha_ + l2_)
+                            - w.array().sign() * l1_,
+                        z);
+
+                auto n_new = n + g.array().square();
+                z += g.array() - (n_new.sqrt() - n.sqrt()) / alpha_ * w.array();
+                n = n_new;
+
+                w.array() = (z.abs() <= l1_).select(0,
+                        -(z - z.sign() * l1_)
+                            / ((beta_ + n.sqrt()) / alpha_ + l2_));
+            });
+        }
+
+        virtual void MoveState(const Eigen::MatrixXd& old,
+                std::shared_ptr<Eigen::MatrixXd> param) {
+            state_.Move(old, param);
+        }
+
+        // Forgets z and n: the next updates start from the current weights
+        void Reset() { state_.Clear(); }
+
+    private:
+        float alpha_;
+        float beta_;
+        float l1_;
+        float l2_;
+        ParamState state_;
+};
+
+} // opt
+
+} // ad
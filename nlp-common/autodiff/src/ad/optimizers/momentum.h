@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../optimizer.h"
+#include "param_state.h"
+
+namespace ad {
+
+namespace opt {
+
+// SGD with momentum: v = mu * v + g, w -= alpha * v. With a sparse gradient,
+// the velocity of untouched columns (or rows) is not decayed.
+class Momentum : public ad::Optimizer {
+    public:
+        Momentum(float alpha, float mu = 0.9) : alpha_(alpha), mu_(mu), state_(1) {}
+
+        virtual void Update(ad::Var& v) {
+            auto& velocity = state_.Get(v).buffers[0];
+            ForEachSlice(v, [&](auto&& w, const auto& g, auto slice) {
+                auto&& vel = slice(velocity);
+                vel = mu_ * vel + g;
+                w -= alpha_ * vel;
+            });
+        }
+
+        virtual void MoveState(const Eigen::MatrixXd& old,
+                std::shared_ptr<Eigen::MatrixXd> param) {
+            state_.Move(old, param);
+        }
+
+    private:
+        float alpha_;
+        float mu_;
+        ParamState state_;
+};
+
+} // opt
+
+} // ad
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../graph.h"
+
+namespace ad {
+
+namespace opt {
+
+// Per-param buffers of an optimizer, shaped like the param and starting at
+// zero. Params are identified by their shared matrix, so that their state
+// survives the graphs being rebuilt, and the buffers grow with zeros when the
+// param is resized. Params owned by a graph are identified by the graph's
+// epoch and their id: their state is dropped once the graph is Reset() or
+// destroyed.
+class ParamState {
+  public:
+    struct Slot {
+        std::weak_ptr<Eigen::MatrixXd> param;
+        // epoch of the graph owning the param, for params without a matrix
+        std::weak_ptr<const uint64_t> epoch;
+        std::vector<Eigen::MatrixXd> buffers;
+        // number of updates applied to the param so far
+        int steps = 0;
+    };
+
+  private:
+    // epochs are never shared by two graphs
+    typedef std::pair<uint64_t, int> NodeKey;
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& k) const {
+            return std::hash<uint64_t>()(k.first) ^ std::hash<int>()(k.second);
+        }
+    };
+
+    size_t nb_buffers_;
+    std::unordered_map<const void*, Slot> shared_;
+    std::unordered_map<NodeKey, Slot, NodeKeyHash> owned_;
+    // epoch of the last owned param updated
+    uint64_t last_epoch_ = 0;
+
+    // Drops the state of the params whose graph was reset or destroyed
+    void PruneOwned() {
+        for (auto it = owned_.begin(); it != owned_.end();) {
+            if (it->second.epoch.expired()) {
+                it = owned_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    Slot& SlotOf(const Var& v) {
+        const auto& param = v.param();
+        if (!param) {
+            uint64_t epoch = v.graph()->epoch();
+            // a new pass started: the previous ones may be dead
+            if (epoch != last_epoch_) {
+                PruneOwned();
+                last_epoch_ = epoch;
+            }
+            Slot& slot = owned_[NodeKey(epoch, v.id())];
+            if (slot.buffers.empty()) {
+                slot.epoch = v.graph()->epoch_token();
+            }
+            return slot;
+        }
+
+        Slot& slot = shared_[param.get()];
+        // another matrix was allocated where a dead param used to be
+        if (slot.param.lock() != param) {
+            slot = Slot();
+            slot.param = param;
+        }
+        return slot;
+    }
+
+  public:
+    explicit ParamState(size_t nb_buffers) : nb_buffers_(nb_buffers) {}
+
+    Slot& Get(const Var& v) {
+        Slot& slot = SlotOf(v);
+
+        int rows = v.value().rows();
+        int cols = v.value().cols();
+        if (slot.buffers.empty()) {
+            slot.buffers.assign(nb_buffers_, Eigen::MatrixXd::Zero(rows, cols));
+        }
+
+        for (auto& buf : slot.buffers) {
+            if (buf.rows() != rows || buf.cols() != cols) {
+                Eigen::MatrixXd grown = Eigen::MatrixXd::Zero(rows, cols);
+                int r = std::min<int>(rows, buf.rows());
+                int c = std::min<int>(cols, buf.cols());
+                grown.topLeftCorner(r, c) = buf.topLeftCorner(r, c);
+                buf.swap(grown);
+            }
+        }
+        return slot;
+    }
+
+    // param replaces old: the state of old is kept for param, and grows with
+    // it on the next Get()
+    void Move(const Eigen::MatrixXd& old,
+            const std::shared_ptr<Eigen::MatrixXd>& param) {
+        auto it = shared_.find(&old);
+        if (it == shared_.end() || it->second.param.expired()) {
+            return;
+        }
+        Slot slot = std::move(it->second);
+        shared_.erase(it);
+        slot.param = param;
+        shared_[param.get()] = std::move(slot);
+    }
+
+    void Clear() {
+        shared_.clear();
+        owned_.clear();
+    }
+};
+
+// Selects the part of a state buffer matching the part of the param being
+// updated
+struct WholeSlice {
+    Eigen::MatrixXd& operator()(Eigen::MatrixXd& m) const { return m; }
+};
+
+struct ColSlice {
+    int idx;
+    Eigen::MatrixXd::ColXpr operator()(Eigen::MatrixXd& m) const {
+        return m.col(idx);
+    }
+};
+
+struct RowSlice {
+    int idx;
+    Eigen::MatrixXd::RowXpr operator()(Eigen::MatrixXd& m) const {
+        return m.row(idx);
+    }
+};
+
+// Calls step(w, g, slice) on the whole param if its gradient is dense, or
+// on each of the columns or rows of its sparse gradient otherwise: untouched
+// parts of the param and of the optimizer state are left alone.
+template <class F>
+void ForEachSlice(Var& v, F step) {
+    if (!v.has_sparse_grad()) {
+        step(v.value(), v.derivative(), WholeSlice());
+        return;
+    }
+
+    const SparseGrad& grad = v.sparse_grad();
+    for (size_t i = 0; i < grad.size(); ++i) {
+        int idx = grad.index(i);
+        if (grad.layout() == SparseGrad::kCols) {
+            step(v.value().col(idx), grad.slice(i), ColSlice{idx});
+        } else {
+            step(v.value().row(idx), grad.slice(i).transpose(), RowSlice{idx});
+        }
+    }
+}
+
+} // opt
+
+} // ad
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../optimizer.h"
+#include "param_state.h"
 
 namespace ad {
 
@@ -11,7 +12,9 @@ class SGD : public ad::Optimizer {
         SGD(float alpha) : alpha_(alpha) {}
 
         virtual void Update(ad::Var& v) {
-            v.value() -= alpha_ * v.derivative();
+            ForEachSlice(v, [&](auto&& w, const auto& g, auto) {
+                w -= alpha_ * g;
+            });
         }
 
     private:
@@ -0,0 +1,97 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace ad {
+
+Profiler::OpStats& Profiler::Get(const char* op) {
+    auto found = stats_.find(op);
+    if (found == stats_.end()) {
+        found = stats_.emplace(op, OpStats()).first;
+    }
+    return found->second;
+}
+
+void Profiler::Add(const char* op, Pass pass, int64_t ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    OpStats& s = Get(op);
+    if (pass == kForward) {
+        ++s.forward_calls;
+        s.forward_ns += ns;
+    } else {
+        ++s.backward_calls;
+        s.backward_ns += ns;
+    }
+}
+
+void Profiler::AddBytes(const char* op, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Get(op).bytes += bytes;
+}
+
+void Profiler::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.clear();
+}
+
+std::map<std::string, Profiler::OpStats> Profiler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::map<std::string, OpStats>(stats_.begin(), stats_.end());
+}
+
+static std::vector<std::pair<std::string, Profiler::OpStats>> ByTotalTime(
+        const std::map<std::string, Profiler::OpStats>& stats) {
+    std::vector<std::pair<std::string, Profiler::OpStats>> sorted(
+            stats.begin(), stats.end());
+    std::stable_sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, Profiler::OpStats>& a,
+               const std::pair<std::string, Profiler::OpStats>& b) {
+                return a.second.forward_ns + a.second.backward_ns
+                    > b.second.forward_ns + b.second.backward_ns;
+            });
+    return sorted;
+}
+
+std::string Profiler::Table() const {
+    std::ostringstream out;
+    out << std::left << std::setw(20) << "op" << std::right
+        << std::setw(12) << "fwd calls" << std::setw(12) << "fwd ms"
+        << std::setw(12) << "bwd calls" << std::setw(12) << "bwd ms"
+        << std::setw(12) << "KiB" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (auto& op : ByTotalTime(stats())) {
+        const OpStats& s = op.second;
+        out << std::left << std::setw(20) << op.first << std::right
+            << std::setw(12) << s.forward_calls
+            << std::setw(12) << s.forward_ns / 1e6
+            << std::setw(12) << s.backward_calls
+            << std::setw(12) << s.backward_ns / 1e6
+            << std::setw(12) << s.bytes / 1024. << "\n";
+    }
+    return out.str();
+}
+
+std::string Profiler::Json() const {
+    std::ostringstream out;
+    out << "[";
+    bool first = true;
+    for (auto& op : ByTotalTime(stats())) {
+        const OpStats& s = op.second;
+        out << (first ? "" : ", ")
+            << "{\"op\": \"" << op.first << "\""
+            << ", \"forward_calls\": " << s.forward_calls
+            << ", \"forward_ns\": " << s.forward_ns
+            << ", \"backward_calls\": " << s.backward_calls
+            << ", \"backward_ns\": " << s.backward_ns
+            << ", \"bytes\": " << s.bytes << "}";
+        first = false;
+    }
+    out << "]";
+    return out.str();
+}
+
+} // ad
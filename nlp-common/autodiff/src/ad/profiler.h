@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace ad {
+
+// Forward time, backward time, number of calls and bytes allocated by every
+// operator of the graphs it is attached to with SetProfiler(). Several graphs,
+// on several threads, can share one to aggregate their numbers.
+class Profiler {
+  public:
+    struct OpStats {
+        size_t forward_calls = 0;
+        int64_t forward_ns = 0;
+        size_t backward_calls = 0;
+        int64_t backward_ns = 0;
+        size_t bytes = 0;
+    };
+
+    enum Pass { kForward, kBackward };
+
+    // Times the call to f() on behalf of op. Does nothing more than f() when
+    // profiler is null.
+    template <class F>
+    static void Time(Profiler* profiler, const char* op, Pass pass, F&& f) {
+        if (!profiler) {
+            f();
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        profiler->Add(op, pass, std::chrono::duration_cast<
+                std::chrono::nanoseconds>(end - start).count());
+    }
+
+    void Add(const char* op, Pass pass, int64_t ns);
+    void AddBytes(const char* op, size_t bytes);
+    void Clear();
+
+    // A copy of the numbers, by operator name
+    std::map<std::string, OpStats> stats() const;
+
+    // One line per operator, the most expensive first
+    std::string Table() const;
+    // [{"op": "Affine", "forward_calls": 3, "forward_ns": 1200, ...}, ...]
+    std::string Json() const;
+
+  private:
+    mutable std::mutex mutex_;
+    // std::less<> finds a name without building a string
+    std::map<std::string, OpStats, std::less<>> stats_;
+
+    OpStats& Get(const char* op);
+};
+
+} // ad
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cassert>
+#include <vector>
+
+#include "Eigen/Dense"
+
+namespace ad {
+
+// Gradient of a dense param that is only non-zero on a few of its columns
+// (the param multiplies a sparse matrix from the left) or rows (from the
+// right). Each touched column or row is stored once, contiguously, and the
+// buffers keep their capacity across Clear().
+class SparseGrad {
+  public:
+    enum Layout { kNone, kCols, kRows };
+
+  private:
+    Layout layout_;
+    int rows_;
+    int cols_;
+
+    std::vector<int> indices_;
+    // column or row index -> position in indices_, -1 when untouched
+    std::vector<int> slots_;
+    std::vector<double> values_;
+
+    int slice_size() const { return layout_ == kCols ? rows_ : cols_; }
+
+  public:
+    SparseGrad() : layout_(kNone), rows_(0), cols_(0) {}
+
+    void Init(int rows, int cols) {
+        Clear();
+        layout_ = kNone;
+        rows_ = rows;
+        cols_ = cols;
+    }
+
+    void Clear() {
+        for (int idx : indices_) {
+            slots_[idx] = -1;
+        }
+        indices_.clear();
+        values_.clear();
+    }
+
+    // The gradient of column or row idx, zero-initialized on first access
+    Eigen::Map<Eigen::VectorXd> Slice(Layout layout, int idx) {
+        if (layout_ == kNone) {
+            layout_ = layout;
+            slots_.assign(layout == kCols ? cols_ : rows_, -1);
+        }
+        assert(layout_ == layout);
+
+        int len = slice_size();
+        if (slots_[idx] == -1) {
+            slots_[idx] = indices_.size();
+            indices_.push_back(idx);
+            values_.resize(values_.size() + len, 0);
+        }
+        return Eigen::Map<Eigen::VectorXd>(&values_[slots_[idx] * len], len);
+    }
+
+    Layout layout() const { return layout_; }
+    size_t size() const { return indices_.size(); }
+    int index(size_t i) const { return indices_[i]; }
+
+    Eigen::Map<const Eigen::VectorXd> slice(size_t i) const {
+        int len = slice_size();
+        return Eigen::Map<const Eigen::VectorXd>(&values_[i * len], len);
+    }
+
+    Eigen::Map<Eigen::VectorXd> slice(size_t i) {
+        int len = slice_size();
+        return Eigen::Map<Eigen::VectorXd>(&values_[i * len], len);
+    }
+};
+
+} // ad
@@ -0,0 +1,82 @@
+#include "thread_pool.h"
+
+namespace ad {
+
+ThreadPool::ThreadPool(int nb_threads)
+    : task_(nullptr), nb_tasks_(0), next_task_(0), nb_done_(0),
+    generation_(0), stop_(false) {
+    for (int i = 0; i < nb_threads; ++i) {
+        threads_.emplace_back([this]() { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : threads_) {
+        t.join();
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = generation_;
+        RunTasks(lock);
+    }
+}
+
+void ThreadPool::RunTasks(std::unique_lock<std::mutex>& lock) {
+    while (next_task_ < nb_tasks_) {
+        int i = next_task_++;
+        lock.unlock();
+        try {
+            (*task_)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> error_lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+        lock.lock();
+        if (++nb_done_ == nb_tasks_) {
+            done_cv_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(int n, const std::function<void(int)>& f) {
+    if (n <= 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &f;
+    nb_tasks_ = n;
+    next_task_ = 0;
+    nb_done_ = 0;
+    error_ = nullptr;
+    ++generation_;
+    work_cv_.notify_all();
+
+    RunTasks(lock);
+    done_cv_.wait(lock, [&]() { return nb_done_ == nb_tasks_; });
+    task_ = nullptr;
+
+    if (error_) {
+        std::exception_ptr error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+} // ad
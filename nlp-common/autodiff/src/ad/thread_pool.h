@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ad {
+
+// A fixed set of worker threads running parallel loops. The thread calling
+// ParallelFor() takes part in the loop, so a pool of size 0 runs everything
+// on the caller.
+class ThreadPool {
+    std::vector<std::thread> threads_;
+
+    // protects everything below
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(int)>* task_;
+    int nb_tasks_;
+    int next_task_;
+    int nb_done_;
+    // incremented by every ParallelFor(), wakes the workers up
+    size_t generation_;
+    bool stop_;
+    std::exception_ptr error_;
+
+    // only one loop runs at a time
+    std::mutex run_mutex_;
+
+    void WorkerLoop();
+    void RunTasks(std::unique_lock<std::mutex>& lock);
+
+  public:
+    explicit ThreadPool(int nb_threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Calls f(0) ... f(n - 1) over the threads and waits for all of them.
+    // The first exception thrown by f is rethrown here. f must not call
+    // ParallelFor() on the same pool.
+    void ParallelFor(int n, const std::function<void(int)>& f);
+
+    int size() const { return threads_.size(); }
+};
+
+} // ad
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ad/ad.h>
+
+// Checks the gradient of every operator of operators.h against finite
+// differences. Prints the error of each and fails if one is too large.
+
+using namespace ad;
+
+static const double kTolerance = 1e-6;
+
+static int nb_failures = 0;
+
+static std::shared_ptr<Eigen::MatrixXd> Random(int rows, int cols) {
+    return std::make_shared<Eigen::MatrixXd>(Eigen::MatrixXd::Random(rows, cols));
+}
+
+// Coefficients in [0.5, 1.5], for Log and NLog
+static std::shared_ptr<Eigen::MatrixXd> Positive(int rows, int cols) {
+    return std::make_shared<Eigen::MatrixXd>(
+            Eigen::MatrixXd::Random(rows, cols).array() * 0.5 + 1);
+}
+
+// Drops the coefficients smaller than 0.5 in magnitude
+static Eigen::SparseMatrix<double> Sparsify(const Eigen::MatrixXd& m) {
+    Eigen::MatrixXd pruned = (m.array().abs() > 0.5).select(m, 0);
+    return pruned.sparseView();
+}
+
+// A one-hot target per column
+static Eigen::MatrixXd OneHot(int rows, int cols) {
+    Eigen::MatrixXd y = Eigen::MatrixXd::Zero(rows, cols);
+    for (int c = 0; c < cols; ++c) {
+        y(rand() % rows, c) = 1;
+    }
+    return y;
+}
+
+static void Check(const std::string& name,
+        const LossFn& loss,
+        const std::vector<std::shared_ptr<Eigen::MatrixXd>>& params) {
+    double error = GradientError(loss, params);
+    bool ok = error < kTolerance;
+    std::cout << name << ": " << error << (ok ? "" : " FAILED") << std::endl;
+    nb_failures += ok ? 0 : 1;
+}
+
+// Weighting the output by a random matrix makes every coefficient of its
+// gradient different
+static Var Reduce(ComputationGraph& g, const Var& v) {
+    Eigen::MatrixXd weights = Eigen::MatrixXd::Random(v.rows(), v.cols());
+    return Sum(v ^ g.CreateConstant(weights));
+}
+
+// The gradient of a param multiplied by a sparse matrix must be the same,
+// whether it is kept sparse or not
+static void CheckSparseGrad() {
+    auto w = Random(3, 4);
+    Eigen::SparseMatrix<double> x = Sparsify(Eigen::MatrixXd::Random(4, 5));
+    Eigen::MatrixXd b = Eigen::MatrixXd::Random(3, 1);
+    Eigen::MatrixXd weights = Eigen::MatrixXd::Random(3, 5);
+
+    ComputationGraph dense;
+    Var dw = dense.CreateParam(w);
+    Var dJ = Sum(Affine(dw, dense.CreateSparseConstant(x),
+                dense.CreateConstant(b)) ^ dense.CreateConstant(weights));
+    dense.BackpropFrom(dJ);
+
+    ComputationGraph sparse;
+    Var sw = sparse.CreateSparseGradParam(w);
+    Var sJ = Sum(Affine(sw, sparse.CreateSparseConstant(x),
+                sparse.CreateConstant(b)) ^ sparse.CreateConstant(weights));
+    sparse.BackpropFrom(sJ);
+
+    Eigen::MatrixXd grad = Eigen::MatrixXd::Zero(3, 4);
+    const SparseGrad& sg = sw.sparse_grad();
+    for (size_t i = 0; i < sg.size(); ++i) {
+        grad.col(sg.index(i)) = sg.slice(i);
+    }
+    double error = (grad - dw.derivative()).cwiseAbs().maxCoeff();
+    bool ok = error < kTolerance;
+    std::cout << "sparse gradient: " << error << (ok ? "" : " FAILED")
+        << std::endl;
+    nb_failures += ok ? 0 : 1;
+}
+
+// A model with no input or no label, like an empty BagOfWords, must still
+// go through Softmax and SoftmaxCrossEntropy
+static void CheckEmpty() {
+    ComputationGraph g;
+    Var x = g.CreateParam(0, 0);
+    Var h = Softmax(x);
+    Var J = SoftmaxCrossEntropy(g.CreateConstant(0, 0), x);
+    g.BackpropFrom(J);
+    g.Forward();
+    bool ok = h.rows() == 0 && h.cols() == 0 && J.value()(0, 0) == 0;
+    std::cout << "empty softmax: " << (ok ? "ok" : "FAILED") << std::endl;
+    nb_failures += ok ? 0 : 1;
+}
+
+int main() {
+    Eigen::MatrixXd c34 = Eigen::MatrixXd::Random(3, 4);
+    Eigen::MatrixXd c45 = Eigen::MatrixXd::Random(4, 5);
+    Eigen::MatrixXd y34 = OneHot(3, 4);
+
+    Check("operator+", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, p[0] + p[1]);
+    }, {Random(3, 4), Random(3, 4)});
+    Check("operator-", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, p[0] - p[1]);
+    }, {Random(3, 4), Random(3, 4)});
+    Check("operator*", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, p[0] * p[1]);
+    }, {Random(3, 4), Random(4, 5)});
+    Check("operator* sparse rhs",
+            [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, p[0] * g.CreateSparseConstant(Sparsify(c45)));
+    }, {Random(3, 4)});
+    Check("operator* sparse lhs",
+            [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, g.CreateSparseConstant(Sparsify(c34)) * p[0]);
+    }, {Random(4, 5)});
+    Check("operator* scalar", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, 3 * p[0]);
+    }, {Random(3, 4)});
+    Check("Relu", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Relu(p[0]));
+    }, {Random(3, 4)});
+    Check("Square", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Square(p[0]));
+    }, {Random(4, 4)});
+    Check("EltSquare", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, EltSquare(p[0]));
+    }, {Random(3, 4)});
+    Check("operator^", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, p[0] ^ p[1]);
+    }, {Random(3, 4), Random(3, 4)});
+    Check("Log", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Log(p[0]));
+    }, {Positive(3, 4)});
+    Check("NLog", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, NLog(p[0]));
+    }, {Positive(3, 4)});
+    Check("CrossEntropy", [&](ComputationGraph&, const std::vector<Var>& p) {
+        return CrossEntropy(p[0], p[1]);
+    }, {Random(3, 4), Positive(3, 4)});
+    Check("SoftmaxCrossEntropy",
+            [&](ComputationGraph&, const std::vector<Var>& p) {
+        return SoftmaxCrossEntropy(p[0], p[1]);
+    }, {Random(3, 4), Random(3, 4)});
+    Check("SoftmaxCrossEntropy one-hot",
+            [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return SoftmaxCrossEntropy(g.CreateConstant(y34), p[0]);
+    }, {Random(3, 4)});
+    Check("Exp", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Exp(p[0]));
+    }, {Random(3, 4)});
+    Check("Softmax", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Softmax(p[0]));
+    }, {Random(3, 4)});
+    Check("Sigmoid", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Sigmoid(p[0]));
+    }, {Random(3, 4)});
+    Check("Sum", [&](ComputationGraph&, const std::vector<Var>& p) {
+        return Sum(p[0]);
+    }, {Random(3, 4)});
+    Check("Mean", [&](ComputationGraph&, const std::vector<Var>& p) {
+        return Mean(p[0]);
+    }, {Random(3, 4)});
+    Check("MSE", [&](ComputationGraph&, const std::vector<Var>& p) {
+        return MSE(p[0], p[1]);
+    }, {Random(3, 4), Random(3, 4)});
+    Check("Affine", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Affine(p[0], p[1], p[2]));
+    }, {Random(3, 4), Random(4, 5), Random(3, 1)});
+    Check("Affine sparse", [&](ComputationGraph& g, const std::vector<Var>& p) {
+        return Reduce(g, Affine(p[0], g.CreateSparseConstant(Sparsify(c45)),
+                    p[1]));
+    }, {Random(3, 4), Random(3, 1)});
+
+    CheckSparseGrad();
+    CheckEmpty();
+
+    return nb_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <nlp/bow.h>
+#include <nlp/dict.h>
+
+// Number of epochs each optimizer needs for BagOfWords to reach a target
+// accuracy on a dataset, and the time they take.
+
+static const int kMaxEpochs = 50;
+
+// Splitting on whitespace keeps the benchmark independent from the locales
+// installed on the machine, unlike Tokenizer::FR.
+Document Parse(const std::string& str, NGramMaker& ngram, LabelSet& ls) {
+    std::ifstream dataset(str);
+    std::string line;
+    Document doc;
+    while (std::getline(dataset, line)) {
+        size_t pipe = line.find('|');
+        if (pipe == std::string::npos) {
+            continue;
+        }
+        std::string data(line, 0, pipe - 1);
+        std::string label(line, pipe + 2, line.size());
+
+        std::vector<WordFeatures> toks;
+        std::istringstream words(data);
+        std::string word;
+        while (words >> word) {
+            toks.emplace_back(word);
+        }
+        ngram.Learn(toks);
+        doc.examples.push_back(TrainingExample{toks, ls.GetLabel(label)});
+    }
+    return doc;
+}
+
+static int Accuracy(const BagOfWords& bow, const Document& doc) {
+    int nb_correct = 0;
+    for (auto& ex : doc.examples) {
+        Eigen::MatrixXd::Index max_row, max_col;
+        bow.ComputeClass(ex.inputs).maxCoeff(&max_row, &max_col);
+        nb_correct += (Label)max_row == ex.output ? 1 : 0;
+    }
+    return nb_correct * 100 / doc.examples.size();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <dataset> [target accuracy]\n";
+        return EXIT_FAILURE;
+    }
+    int target = argc > 2 ? atoi(argv[2]) : 99;
+
+    NGramMaker ngram;
+    LabelSet ls;
+    Document doc = Parse(argv[1], ngram, ls);
+
+    std::vector<std::pair<std::string, std::function<ad::Optimizer*()>>> opts = {
+        {"SGD(0.01)", []() { return new ad::opt::SGD(0.01); }},
+        {"Momentum(0.01)", []() { return new ad::opt::Momentum(0.01); }},
+        {"Adagrad(0.1)", []() { return new ad::opt::Adagrad(0.1); }},
+        {"Adam(0.01)", []() { return new ad::opt::Adam(0.01); }},
+    };
+
+    std::cout << "target: " << target << "% accuracy, " << doc.examples.size()
+        << " examples\n";
+    std::cout << "     optimizer  epochs  ms/epoch\n";
+    for (auto& opt : opts) {
+        // same initial weights for every optimizer
+        srand(0);
+        BagOfWords bow(ngram.dict().size(), ls.size());
+        bow.SetOptimizer(std::unique_ptr<ad::Optimizer>(opt.second()));
+
+        int epochs = 0;
+        double ms = 0;
+        while (epochs < kMaxEpochs && Accuracy(bow, doc) < target) {
+            auto start = std::chrono::steady_clock::now();
+            bow.Train(doc);
+            auto end = std::chrono::steady_clock::now();
+            ms += std::chrono::duration<double, std::milli>(end - start).count();
+            ++epochs;
+        }
+
+        std::cout << std::setw(14) << opt.first << std::setw(8);
+        if (Accuracy(bow, doc) < target) {
+            std::cout << "-";
+        } else {
+            std::cout << epochs;
+        }
+        std::cout << std::setw(10) << std::setprecision(3)
+            << (epochs ? ms / epochs : 0) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <nlp/rules-matcher.h>
+
+// Throughput of RulesMatcher, in sentences/sec, against testing every
+// Rule::Matches() in turn, on random rules and sentences over a vocabulary
+// following a Zipf law.
+
+static const size_t kVocabulary = 5000;
+static const size_t kSentenceLength = 15;
+static const size_t kPatternLength = 4;
+
+class Zipf {
+    std::discrete_distribution<size_t> dist_;
+
+  public:
+    explicit Zipf(size_t n) : dist_(n, 0, n, [](double x) { return 1 / x; }) {}
+    size_t operator()(std::mt19937& rng) { return dist_(rng); }
+};
+
+static std::string RandomRule(size_t key, Zipf& zipf, std::mt19937& rng) {
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::string rule = "r" + std::to_string(key) + " :";
+    if (kind(rng) < 3) {
+        rule += " ^";
+    }
+    size_t len = 1 + rng() % kPatternLength;
+    for (size_t i = 0; i < len; ++i) {
+        int k = kind(rng);
+        if (i > 0 && k == 0) {
+            rule += " _";
+        } else if (i > 0 && k == 1) {
+            rule += " *";
+        } else {
+            rule += " w" + std::to_string(zipf(rng));
+        }
+    }
+    if (kind(rng) < 2) {
+        rule += " $";
+    }
+    return rule;
+}
+
+template <class F>
+static double Seconds(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    size_t nb_rules = argc > 1 ? atoi(argv[1]) : 10000;
+    size_t nb_sentences = argc > 2 ? atoi(argv[2]) : 2000;
+    int nb_threads = argc > 3 ? atoi(argv[3]) : 4;
+    if (nb_rules < 1 || nb_sentences < 1 || nb_threads < 1) {
+        std::cerr << "Usage: " << argv[0]
+            << " [rules] [sentences] [threads]\n";
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(0);
+    Zipf zipf(kVocabulary);
+    Dictionnary dict;
+    for (size_t i = 0; i < kVocabulary; ++i) {
+        dict.GetWordId("w" + std::to_string(i));
+    }
+
+    RulesMatcher rm;
+    std::vector<Rule> rules;
+    for (size_t i = 0; i < nb_rules; ++i) {
+        std::string rule = RandomRule(i, zipf, rng);
+        rm.AddRule(rule, dict);
+        rules.emplace_back(rule);
+    }
+
+    Document doc;
+    doc.examples.resize(nb_sentences);
+    auto& sentences = doc.examples;
+    for (auto& ex : sentences) {
+        for (size_t i = 0; i < kSentenceLength; ++i) {
+            ex.inputs.push_back(WordFeatures("w" + std::to_string(zipf(rng))));
+            ex.inputs.back().idx = dict.FindWordId(ex.inputs.back().str);
+        }
+    }
+
+    size_t nb_loop = 0;
+    double loop_s = Seconds([&]() {
+        for (auto& ex : sentences) {
+            for (auto& r : rules) {
+                nb_loop += r.Matches(ex) ? 1 : 0;
+            }
+        }
+    });
+
+    size_t nb_matched = 0;
+    double match_s = Seconds([&]() {
+        for (auto& ex : sentences) {
+            nb_matched += rm.Match(ex).size();
+        }
+    });
+
+    RulesMatcher::Scratch scratch;
+    size_t nb_scratch = 0;
+    double scratch_s = Seconds([&]() {
+        for (auto& ex : sentences) {
+            nb_scratch += rm.Match(ex, scratch).size();
+        }
+    });
+
+    if (nb_loop != nb_matched || nb_loop != nb_scratch) {
+        std::cerr << "mismatch: " << nb_loop << " matches with Rule::Matches, "
+            << nb_matched << " and " << nb_scratch << " with Match\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << nb_rules << " rules, " << nb_sentences << " sentences of "
+        << kSentenceLength << " words, " << nb_loop << " matches\n";
+    std::cout << "                   sentences/s\n" << std::fixed
+        << std::setprecision(0)
+        << "  Rule::Matches  " << std::setw(13) << nb_sentences / loop_s << "\n"
+        << "  Match          " << std::setw(13) << nb_sentences / match_s << "\n"
+        << "  Match, scratch " << std::setw(13) << nb_sentences / scratch_s
+        << "\n";
+
+    std::cout << "\nMatchAll\n  threads  sentences/s\n";
+    for (int threads = 1; threads <= nb_threads; threads *= 2) {
+        ad::ThreadPool pool(threads - 1);
+        RulesMatcher::Matches matches;
+        double all_s = Seconds([&]() { matches = rm.MatchAll(doc, pool); });
+        if (matches.rules.size() != nb_loop) {
+            std::cerr << "mismatch: " << matches.rules.size()
+                << " matches with MatchAll\n";
+            return EXIT_FAILURE;
+        }
+        std::cout << std::setw(9) << threads << std::setw(13)
+            << nb_sentences / all_s << "\n";
+    }
+    return 0;
+}
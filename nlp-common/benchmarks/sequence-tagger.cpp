@@ -0,0 +1,171 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <nlp/sequence-tagger.h>
+
+// Tagging and training throughput of SequenceTagger, in tokens/sec, on
+// sentences sampled from a random HMM. Label 0 and word 0 are START, label 1
+// and word 1 are STOP. The words of a label share a suffix, and some words
+// of the test set are unknown: only the hashed features can tag them.
+
+static const size_t kWordsPerLabel = 20;
+static const int kEpochs = 5;
+static const size_t kSentenceLength = 25;
+static const double kUnknownRate = 0.1;
+static const size_t kUnknown = static_cast<unsigned int>(-1);
+
+static Document Sample(size_t nb_sentences,
+                       size_t nb_labels,
+                       double unknown_rate,
+                       std::mt19937& rng) {
+    std::uniform_int_distribution<size_t> label(2, nb_labels - 1);
+    std::uniform_int_distribution<size_t> word(0, kWordsPerLabel - 1);
+    std::uniform_int_distribution<int> coin(0, 3);
+    std::bernoulli_distribution unknown(unknown_rate);
+
+    Document doc;
+    for (size_t s = 0; s < nb_sentences; ++s) {
+        TrainingExample ex;
+        size_t pos = label(rng);
+        for (size_t i = 0; i < kSentenceLength; ++i) {
+            // a label mostly follows its predecessor, so that transitions
+            // matter
+            pos = coin(rng) ? 2 + (pos - 1) % (nb_labels - 2) : label(rng);
+            size_t idx = 2 + (pos - 2) * kWordsPerLabel + word(rng);
+            if (unknown(rng)) {
+                idx += nb_labels * kWordsPerLabel;
+            }
+            std::string suffix = {char('a' + pos % 26), char('a' + pos / 26)};
+            WordFeatures w("w" + std::to_string(idx) + suffix);
+            w.idx = idx < nb_labels * kWordsPerLabel ? idx : kUnknown;
+            w.pos = pos;
+            ex.inputs.push_back(w);
+        }
+        doc.examples.push_back(ex);
+    }
+    return doc;
+}
+
+static size_t NbTokens(const Document& doc) {
+    size_t nb = 0;
+    for (auto& ex : doc.examples) {
+        nb += ex.inputs.size();
+    }
+    return nb;
+}
+
+template <class F>
+static double Seconds(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Tags test with tagger, returns the accuracy
+static double Tag(SequenceTagger& tagger,
+                  const Document& test,
+                  double* tag_s,
+                  const DecodeOptions& opts = DecodeOptions()) {
+    size_t nb_correct = 0;
+    std::vector<WordFeatures> ws;
+    *tag_s = Seconds([&]() {
+        for (auto& ex : test.examples) {
+            ws = ex.inputs;
+            tagger.Compute(ws, opts);
+            for (size_t i = 0; i < ws.size(); ++i) {
+                nb_correct += ws[i].pos == ex.inputs[i].pos ? 1 : 0;
+            }
+        }
+    });
+    return 100.0 * nb_correct / NbTokens(test);
+}
+
+int main(int argc, char** argv) {
+    size_t nb_labels = argc > 1 ? atoi(argv[1]) : 45;
+    size_t nb_sentences = argc > 2 ? atoi(argv[2]) : 2000;
+    int nb_threads = argc > 3 ? atoi(argv[3]) : 4;
+    if (nb_labels < 3 || nb_threads < 1) {
+        std::cerr << "Usage: " << argv[0]
+            << " [labels >= 3] [sentences] [threads]\n";
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(0);
+    Document train = Sample(nb_sentences, nb_labels, 0, rng);
+    Document test = Sample(nb_sentences, nb_labels, kUnknownRate, rng);
+    size_t nb_words = 2 + (nb_labels - 2) * kWordsPerLabel;
+
+    std::cout << nb_labels << " labels, " << nb_words << " words, "
+        << nb_sentences << " sentences of " << kSentenceLength << " words, "
+        << kEpochs << " epochs\n";
+    std::cout << "    training  train tok/s  tag tok/s  accuracy\n";
+
+    auto report = [&](const std::string& name,
+                      size_t feature_space,
+                      const std::function<void(SequenceTagger&)>& epoch) {
+        SequenceTagger tagger(
+                nb_words, nb_labels, 0, 0, 1, 1, feature_space);
+        double train_s = Seconds([&]() {
+            for (int i = 0; i < kEpochs; ++i) {
+                epoch(tagger);
+            }
+        });
+        double tag_s;
+        double accuracy = Tag(tagger, test, &tag_s);
+        std::cout << std::setw(12) << name << std::fixed << std::setprecision(0)
+            << std::setw(13) << kEpochs * NbTokens(train) / train_s
+            << std::setw(11) << NbTokens(test) / tag_s
+            << std::setprecision(1) << std::setw(9) << accuracy << "%\n";
+    };
+
+    const size_t kFeatures = SequenceTagger::kDefaultFeatureSpace;
+    report("softmax", kFeatures, [&](SequenceTagger& t) { t.Train(train); });
+    report("crf", kFeatures, [&](SequenceTagger& t) { t.TrainCRF(train); });
+    report("crf, words", 0, [&](SequenceTagger& t) { t.TrainCRF(train); });
+    for (int threads = 2; threads <= nb_threads; threads *= 2) {
+        ad::ThreadPool pool(threads - 1);
+        report("crf x" + std::to_string(threads), kFeatures,
+               [&](SequenceTagger& t) { t.TrainCRF(train, &pool); });
+    }
+
+    SequenceTagger crf(nb_words, nb_labels, 0, 0, 1, 1);
+    for (int i = 0; i < kEpochs; ++i) {
+        crf.TrainCRF(train);
+    }
+    std::cout << "\nCRF decoding\n  beam  top k  tag tok/s  accuracy\n";
+    std::vector<DecodeOptions> decoders = {
+        {0, 0}, {16, 0}, {4, 0}, {1, 0}, {16, 8}, {4, 4},
+    };
+    for (auto& opts : decoders) {
+        double tag_s;
+        double accuracy = Tag(crf, test, &tag_s, opts);
+        std::cout << std::setw(6) << opts.beam_width
+            << std::setw(7) << opts.top_k_transitions << std::setprecision(0)
+            << std::setw(11) << NbTokens(test) / tag_s
+            << std::setprecision(1) << std::setw(9) << accuracy << "%\n";
+    }
+
+    std::vector<std::vector<WordFeatures>> sentences;
+    std::vector<Label> tags(NbTokens(test));
+    std::vector<Label*> outputs;
+    for (auto& ex : test.examples) {
+        outputs.push_back(tags.data() + sentences.size() * kSentenceLength);
+        sentences.push_back(ex.inputs);
+    }
+    std::cout << "\nCRF batch tagging\n  threads  tag tok/s\n";
+    for (int threads = 1; threads <= nb_threads; threads *= 2) {
+        ad::ThreadPool pool(threads - 1);
+        double tag_s = Seconds([&]() {
+            crf.TagBatch(sentences, outputs, pool);
+        });
+        std::cout << std::setw(9) << threads << std::setprecision(0)
+            << std::setw(11) << NbTokens(test) / tag_s << "\n";
+    }
+    return 0;
+}
@@ -1,20 +1,80 @@
 #include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
 
 #include "bow.h"
 
 static const unsigned int kNotFound = -1;
 static const double kLearningRate = 0.001;
+static const double kAdagradLearningRate = 0.1;
+static const double kFtrlAlpha = 0.1;
+static const double kFtrlBeta = 1;
+static const double kFtrlL1 = 0.001;
+static const double kFtrlL2 = 0;
+// L2 penalty of w, see Step()
+static const double kWeightDecay = 0.0001;
 
 static double randr(float from, float to) {
     double distance = to - from;
     return ((double)rand() / ((double)RAND_MAX + 1) * distance) + from;
 }
 
+struct BagOfWords::ModelGraph {
+    ad::ComputationGraph g;
+    ad::Var w;
+    ad::Var b;
+    ad::Var x;
+    ad::Var y;
+    ad::Var logits;
+    ad::Var h;
+    ad::Var J;
+
+    // word ids of the current input, kept to avoid reallocating
+    std::vector<int> ids;
+
+    ModelGraph(std::shared_ptr<Eigen::MatrixXd> w_weights,
+               std::shared_ptr<Eigen::MatrixXd> b_weights,
+               size_t in_sz,
+               size_t out_sz,
+               bool train)
+        : w(nullptr), b(nullptr), x(nullptr), y(nullptr), logits(nullptr),
+          h(nullptr), J(nullptr) {
+        using namespace ad;
+
+        g.SetGradEnabled(train);
+        // an example only has a few words: only the matching columns of w
+        // get a gradient
+        w = g.CreateSparseGradParam(w_weights);
+        b = g.CreateParam(b_weights);
+        x = g.CreateSparseConstant(in_sz, 1);
+        logits = Affine(w, x, b);
+
+        if (train) {
+            y = g.CreateConstant(out_sz, 1);
+            J = SoftmaxCrossEntropy(y, logits) + 0.001 * Mean(EltSquare(b));
+            // Step() reads the logits after the backward pass
+            g.PlanMemory(J, {logits});
+        } else {
+            h = Softmax(logits);
+            g.PlanMemory(h);
+        }
+    }
+};
+
+struct BagOfWords::Weights {
+    std::shared_ptr<Eigen::MatrixXd> w;
+    std::shared_ptr<Eigen::MatrixXd> b;
+};
+
 BagOfWords::BagOfWords(size_t in_sz, size_t out_sz)
     : w_weights_(std::make_shared<Eigen::MatrixXd>(out_sz, in_sz)),
       b_weights_(std::make_shared<Eigen::MatrixXd>(out_sz, 1)),
       input_size_(in_sz),
-      output_size_(out_sz) {
+      output_size_(out_sz),
+      optimizer_(new ad::opt::Adagrad(kAdagradLearningRate)),
+      online_optimizer_(
+          new ad::opt::FTRL(kFtrlAlpha, kFtrlBeta, kFtrlL1, kFtrlL2)),
+      profiler_(nullptr) {
     auto& b_mat = *b_weights_;
     auto& w_mat = *w_weights_;
 
@@ -25,44 +85,116 @@ BagOfWords::BagOfWords(size_t in_sz, size_t out_sz)
             w_mat(i, j) = randr(-1, 1);
         }
     }
+    Capture();
 }
 
 BagOfWords::BagOfWords()
     : w_weights_(std::make_shared<Eigen::MatrixXd>(0, 0)),
       b_weights_(std::make_shared<Eigen::MatrixXd>(0, 1)),
       input_size_(0),
-      output_size_(0) {}
+      output_size_(0),
+      optimizer_(new ad::opt::Adagrad(kAdagradLearningRate)),
+      online_optimizer_(
+          new ad::opt::FTRL(kFtrlAlpha, kFtrlBeta, kFtrlL1, kFtrlL2)),
+      profiler_(nullptr) {
+    Capture();
+}
 
-ad::Var BagOfWords::ComputeModel(ad::ComputationGraph& g,
-                                 ad::Var& w,
-                                 ad::Var& b,
-                                 const std::vector<WordFeatures>& ws) const {
-    Eigen::MatrixXd input(input_size_, 1);
-    input.setZero();
+BagOfWords::BagOfWords(BagOfWords&&) = default;
+BagOfWords& BagOfWords::operator=(BagOfWords&&) = default;
+BagOfWords::~BagOfWords() = default;
 
+void BagOfWords::Capture() {
+    train_graph_.reset(new ModelGraph(
+        w_weights_, b_weights_, input_size_, output_size_, true));
+    train_graph_->g.SetProfiler(profiler_);
+    std::atomic_store(&published_, std::shared_ptr<const Weights>(
+        new Weights{w_weights_, b_weights_}));
+}
+
+void BagOfWords::ReplaceWeights(std::shared_ptr<Eigen::MatrixXd> w,
+                                std::shared_ptr<Eigen::MatrixXd> b) {
+    for (ad::Optimizer* opt : {optimizer_.get(),
+             static_cast<ad::Optimizer*>(online_optimizer_.get())}) {
+        opt->MoveState(*w_weights_, w);
+        opt->MoveState(*b_weights_, b);
+    }
+    w_weights_ = std::move(w);
+    b_weights_ = std::move(b);
+}
+
+void BagOfWords::SetInput(ModelGraph& m,
+                          const std::vector<WordFeatures>& ws) const {
+    // the graph may be older than the model: it knows its own input size
+    size_t in_sz = m.x.sparse_value().rows();
+    m.ids.clear();
     for (auto& wf : ws) {
-        // one hot encode each word
-        if (wf.idx < input_size_) {
-            input(wf.idx, 0) = 1;
+        if (wf.idx < in_sz) {
+            m.ids.push_back(wf.idx);
         }
     }
+    std::sort(m.ids.begin(), m.ids.end());
+    m.ids.erase(std::unique(m.ids.begin(), m.ids.end()), m.ids.end());
 
-    ad::Var x = g.CreateParam(input);
-
-    return ad::Softmax(w * x + b);
+    // one hot encode each word. Filling the column in order keeps the
+    // storage of the sparse matrix.
+    auto& input = m.x.sparse_value();
+    input.setZero();
+    input.reserve(m.ids.size());
+    input.startVec(0);
+    for (int id : m.ids) {
+        input.insertBack(id, 0) = 1;
+    }
+    input.finalize();
 }
 
 Eigen::MatrixXd BagOfWords::ComputeClass(
     const std::vector<WordFeatures>& ws) const {
-    ad::ComputationGraph g;
-    ad::Var w = g.CreateParam(w_weights_);
-    ad::Var b = g.CreateParam(b_weights_);
+    std::shared_ptr<const Weights> weights = std::atomic_load(&published_);
+
+    // Each thread replays a graph of its own, captured again when it last
+    // ran on other weights. The graph keeps them alive until then.
+    static thread_local std::shared_ptr<const Weights> graph_weights;
+    static thread_local std::unique_ptr<ModelGraph> graph;
+    if (graph_weights != weights) {
+        graph.reset(new ModelGraph(weights->w, weights->b,
+                                   weights->w->cols(), weights->w->rows(),
+                                   false));
+        graph_weights = weights;
+    }
 
-    return ComputeModel(g, w, b, ws).value();
+    ModelGraph& m = *graph;
+    SetInput(m, ws);
+    m.g.Forward();
+    return m.h.value();
+}
+
+bool BagOfWords::Step(const TrainingExample& ex, ad::Optimizer& opt) {
+    ModelGraph& m = *train_graph_;
+
+    SetInput(m, ex.inputs);
+    m.y.value().setZero();
+    m.y.value()(ex.output, 0) = 1;
+
+    m.g.Forward();
+    m.g.ClearGrad();
+    m.g.BackpropFrom(m.J);
+    // The L2 penalty of w, kWeightDecay / 2 * |w|^2, is applied lazily: only
+    // the columns of the words of ex get its gradient, along with theirs.
+    ad::SparseGrad& dw = m.w.sparse_grad();
+    for (size_t i = 0; i < dw.size(); ++i) {
+        dw.slice(i) += kWeightDecay * m.w.value().col(dw.index(i));
+    }
+    m.g.Update(opt, {&m.w, &m.b});
+
+    // the softmax does not change the argmax
+    Eigen::MatrixXd::Index max_row, max_col;
+    m.logits.value().maxCoeff(&max_row, &max_col);
+    Label predicted = max_row;
+    return predicted == ex.output;
 }
 
 int BagOfWords::Train(const Document& doc) {
-    double nll = 0;
     int nb_correct = 0;
     int nb_tokens = 0;
 
@@ -70,40 +202,29 @@ int BagOfWords::Train(const Document& doc) {
         return 0;
     }
 
-    for (auto& ex : doc.examples) {
-        using namespace ad;
-
-        Eigen::MatrixXd y_mat(output_size_, 1);
-        y_mat.setZero();
-        y_mat(ex.output, 0) = 1;
-
-        ComputationGraph g;
-        Var w = g.CreateParam(w_weights_);
-        Var b = g.CreateParam(b_weights_);
-        Var y = g.CreateParam(y_mat);
-
-        Var h = ComputeModel(g, w, b, ex.inputs);
-
-        // MSE is weirdly doing better than Cross Entropy
-        Var J =
-            ad::MSE(y, h) + 0.001 * (Mean(EltSquare(w)) * Mean(EltSquare(b)));
+    // the weights are about to change under the online learner's feet
+    online_optimizer_->Reset();
 
-        opt::SGD sgd(0.01);
-        g.BackpropFrom(J);
-        g.Update(sgd, {&w, &b});
-
-        Eigen::MatrixXd& h_mat = h.value();
-        Eigen::MatrixXd::Index max_row, max_col;
-        h_mat.maxCoeff(&max_row, &max_col);
-        Label predicted = max_row;
-        nb_correct += predicted == ex.output ? 1 : 0;
+    for (auto& ex : doc.examples) {
+        nb_correct += Step(ex, *optimizer_) ? 1 : 0;
         ++nb_tokens;
-
-        nll += J.value()(0, 0);
     }
     return nb_correct * 100 / nb_tokens;
 }
 
+bool BagOfWords::Learn(const TrainingExample& ex) {
+    return Step(ex, *online_optimizer_);
+}
+
+void BagOfWords::SetOptimizer(std::unique_ptr<ad::Optimizer> opt) {
+    optimizer_ = std::move(opt);
+}
+
+void BagOfWords::SetProfiler(ad::Profiler* profiler) {
+    profiler_ = profiler;
+    train_graph_->g.SetProfiler(profiler);
+}
+
 std::string BagOfWords::Serialize() const {
     std::ostringstream out;
 
@@ -158,15 +279,18 @@ void BagOfWords::ResizeInput(size_t in) {
         return;
     }
 
-    Eigen::MatrixXd& w_mat = *w_weights_;
-    w_mat.conservativeResize(output_size_, in);
+    auto w = std::make_shared<Eigen::MatrixXd>(output_size_, in);
+    Eigen::MatrixXd& w_mat = *w;
+    w_mat.leftCols(input_size_) = *w_weights_;
 
-    for (int row = 0, nb_rows = w_weights_->rows(); row < nb_rows; ++row) {
+    for (int row = 0, nb_rows = w_mat.rows(); row < nb_rows; ++row) {
         for (size_t i = input_size_; i < in; ++i) {
             w_mat(row, i) = randr(-1, 1);
         }
     }
+    ReplaceWeights(w, b_weights_);
     input_size_ = in;
+    Capture();
 }
 
 void BagOfWords::ResizeOutput(size_t out) {
@@ -174,13 +298,15 @@ void BagOfWords::ResizeOutput(size_t out) {
         return;
     }
 
-    Eigen::MatrixXd& w_mat = *w_weights_;
-    w_mat.conservativeResize(out, input_size_);
-    Eigen::MatrixXd& b_mat = *b_weights_;
-    b_mat.conservativeResize(out, 1);
+    auto w = std::make_shared<Eigen::MatrixXd>(out, input_size_);
+    Eigen::MatrixXd& w_mat = *w;
+    w_mat.topRows(output_size_) = *w_weights_;
+    auto b = std::make_shared<Eigen::MatrixXd>(out, 1);
+    Eigen::MatrixXd& b_mat = *b;
+    b_mat.topRows(output_size_) = *b_weights_;
 
     for (unsigned row = output_size_; row < out; ++row) {
-        for (unsigned col = 0, nb_cols = w_weights_->cols(); col < nb_cols;
+        for (unsigned col = 0, nb_cols = w_mat.cols(); col < nb_cols;
              ++col) {
             w_mat(row, col) = randr(-1, 1);
         }
@@ -190,7 +316,9 @@ void BagOfWords::ResizeOutput(size_t out) {
         b_mat(row, 0) = randr(-1, 1);
     }
 
+    ReplaceWeights(w, b);
     output_size_ = out;
+    Capture();
 }
 
 double BagOfWords::weights(size_t label, size_t word) const {
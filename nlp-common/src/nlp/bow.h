@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <memory>
 
 #include <Eigen/Dense>
 #include <ad/ad.h>
@@ -10,18 +11,44 @@
 #include "document.h"
 
 class BagOfWords {
+    // The model captured once as an ad graph, replayed for every example
+    struct ModelGraph;
+    // The weights predictions run on
+    struct Weights;
+
+    // Never resized in place: growing the model swaps in bigger copies
     std::shared_ptr<Eigen::MatrixXd> w_weights_; //(out_sz, in_sz)
     std::shared_ptr<Eigen::MatrixXd> b_weights_; //(out_sz, 1)
     size_t input_size_;
     size_t output_size_;
 
-    ad::Var ComputeModel(
-            ad::ComputationGraph& g, ad::Var& w, ad::Var& b,
-            const std::vector<WordFeatures>& ws) const;
+    // Rebuilt whenever the dimensions change
+    std::unique_ptr<ModelGraph> train_graph_;
+    // Published with std::atomic_store whenever the dimensions change.
+    // ComputeClass() loads it once and replays it in a graph of its thread.
+    std::shared_ptr<const Weights> published_;
+
+    // Keeps its per-weight state from one call to Train() to the next
+    std::unique_ptr<ad::Optimizer> optimizer_;
+    // Used by Learn(), reset by Train()
+    std::unique_ptr<ad::opt::FTRL> online_optimizer_;
+    ad::Profiler* profiler_;
+
+    void Capture();
+    // Swaps in w and b, grown copies of the weights, along with the
+    // optimizers' state
+    void ReplaceWeights(std::shared_ptr<Eigen::MatrixXd> w,
+                        std::shared_ptr<Eigen::MatrixXd> b);
+    void SetInput(ModelGraph& m, const std::vector<WordFeatures>& ws) const;
+    // One gradient step on ex, returns whether it was correctly classified
+    bool Step(const TrainingExample& ex, ad::Optimizer& opt);
 
   public:
     BagOfWords(size_t in_sz, size_t out_sz);
     BagOfWords();
+    BagOfWords(BagOfWords&&);
+    BagOfWords& operator=(BagOfWords&&);
+    ~BagOfWords();
 
     double weights(size_t label, size_t word) const;
     Eigen::MatrixXd& weights() const;
@@ -30,9 +57,23 @@ class BagOfWords {
     std::string Serialize() const;
     static BagOfWords FromSerialized(std::istream& file);
 
+    // Safe to call from several threads, and while another one resizes the
+    // model. Training updates the weights in place: a prediction running
+    // meanwhile may see some of them before the step and some after.
     Eigen::MatrixXd ComputeClass(const std::vector<WordFeatures>& ws) const;
 
     int Train(const Document& doc);
+    // Adagrad by default
+    void SetOptimizer(std::unique_ptr<ad::Optimizer> opt);
+
+    // Online learning: a single FTRL-Proximal step on ex, touching only the
+    // weights of its words. Returns whether ex was correctly classified
+    // before the update.
+    bool Learn(const TrainingExample& ex);
+
+    // Profiles the training graph, until set back to null. The inference
+    // graphs are never profiled: ComputeClass() may run on other threads.
+    void SetProfiler(ad::Profiler* profiler);
 
     void ResizeInput(size_t in);
     void ResizeOutput(size_t out);
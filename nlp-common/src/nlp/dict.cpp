@@ -1,14 +1,24 @@
 #include "dict.h"
 
+#include <atomic>
 #include <sstream>
 
+static uint64_t NextVersion() {
+    static std::atomic<uint64_t> next_version(0);
+    return ++next_version;
+}
+
 Dictionnary::Dictionnary()
-        : max_freq_(0) {
+        : max_freq_(0), version_(NextVersion()) {
     unk_id_ = GetWordId("_UNK_");
 }
 
 size_t Dictionnary::GetWordId(const std::string& w) {
-    size_t id = dict_.insert(decltype (dict_)::value_type(w, dict_.size())).first->right;
+    auto res = dict_.insert(decltype (dict_)::value_type(w, dict_.size()));
+    if (res.second) {
+        version_ = NextVersion();
+    }
+    size_t id = res.first->right;
     if (stats_.size() < id + 1) {
         stats_.resize(id + 1);
         stats_[id] = 1;
@@ -35,6 +45,12 @@ void NGramMaker::Annotate(std::vector<WordFeatures>& sentence) {
     }
 }
 
+void NGramMaker::Lookup(std::vector<WordFeatures>& sentence) const {
+    for (auto& s : sentence) {
+        s.idx = dict_.FindWordId(s.str);
+    }
+}
+
 void NGramMaker::Learn(std::vector<WordFeatures>& sentence) {
     for (auto& s : sentence) {
         s.idx = dict_.GetWordId(s.str);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -12,13 +13,23 @@ class Dictionnary {
     mutable std::vector<size_t> stats_;
     size_t max_freq_;
     size_t unk_id_;
+    uint64_t version_;
 
   public:
     Dictionnary();
     bool IsInVocab(const std::string& w) { return dict_.left.find(w) != dict_.left.end(); }
     size_t GetWordId(const std::string& w);
     size_t GetWordIdOrUnk(const std::string& w);
+    // Same, without counting the occurrence
+    size_t FindWordId(const std::string& w) const {
+        auto res = dict_.left.find(w);
+        return res == dict_.left.end() ? unk_id_ : res->second;
+    }
+    size_t unk_id() const { return unk_id_; }
     size_t size() const { return dict_.size(); }
+    // Changes whenever a word is added, and is never shared by dictionaries
+    // with different words, copies aside
+    uint64_t version() const { return version_; }
     std::string Serialize() const;
     static Dictionnary FromSerialized(std::istream& in);
     boost::bimap<std::string, size_t>::left_map::iterator begin() { return dict_.left.begin(); }
@@ -30,6 +41,9 @@ class NGramMaker {
     Dictionnary dict_;
   public:
     void Annotate(std::vector<WordFeatures>& sentence);
+    // Same, without counting the occurrences of the words: several threads
+    // can look up at once, as long as none of them learns words
+    void Lookup(std::vector<WordFeatures>& sentence) const;
     void Learn(std::vector<WordFeatures>& sentence);
     const Dictionnary& dict() const { return dict_; }
     std::string WordFromId(size_t id) const { return dict_.WordFromId(id); }
@@ -15,6 +15,10 @@ class LabelSet {
 
     void AddLabel(const std::string& str) { GetLabel(str); }
 
+    bool HasLabel(const std::string& str) const {
+        return labels_.left.find(str) != labels_.left.end();
+    }
+
     std::string GetString(Label pos) const {
         return labels_.right.at(pos);
     }
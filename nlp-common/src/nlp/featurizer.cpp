@@ -7,3 +7,133 @@ std::vector<WordFeatures> FeaturesExtractor::Do(const std::vector<std::string>&
     }
     return fs;
 }
+
+namespace {
+
+const uint64_t kFnvBasis = 14695981039346656037ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+
+inline uint64_t HashByte(uint64_t h, unsigned char c) {
+    return (h ^ c) * kFnvPrime;
+}
+
+// Mixes the template into h, so that equal strings give different features
+// for different templates
+inline uint64_t Mix(uint64_t h, int tmpl) {
+    h ^= (tmpl + 1) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Whether c starts a UTF-8 code point, rather than continuing one
+inline bool IsLead(unsigned char c) {
+    return (c & 0xC0) != 0x80;
+}
+
+// Whether the code point starting at s[i] is an uppercase Latin-1 letter,
+// U+00C0 to U+00DE but U+00D7, encoded C3 80 to C3 9E
+inline bool IsLatin1Upper(const std::string& s, size_t i) {
+    if (static_cast<unsigned char>(s[i]) != 0xC3 || i + 1 >= s.size()) {
+        return false;
+    }
+    unsigned char next = s[i + 1];
+    return next >= 0x80 && next <= 0x9E && next != 0x97;
+}
+
+// s[i], lowercased whatever the locale. Only ASCII and Latin-1 letters are
+// folded: the other scripts keep their case.
+inline unsigned char Lower(const std::string& s, size_t i) {
+    unsigned char c = s[i];
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 'a';
+    }
+    if (i > 0 && IsLatin1Upper(s, i - 1)) {
+        return c + 0x20;
+    }
+    return c;
+}
+
+// Class of the code point starting at s[i]
+inline char ShapeClass(const std::string& s, size_t i) {
+    unsigned char u = s[i];
+    if ((u >= 'A' && u <= 'Z') || IsLatin1Upper(s, i)) {
+        return 'X';
+    }
+    if ((u >= 'a' && u <= 'z') || u >= 0x80) {
+        return 'x';
+    }
+    if (u >= '0' && u <= '9') {
+        return 'd';
+    }
+    return s[i];
+}
+
+} // anonymous
+
+void FeatureTemplates::Extract(
+        const std::vector<WordFeatures>& ws, size_t space, FeatureId* ids) {
+    // the word before the first one and after the last one
+    const uint64_t kBoundary = Mix(kFnvBasis, kNbTemplates);
+    uint64_t prev_lower = kBoundary;
+
+    for (size_t t = 0; t < ws.size(); ++t) {
+        const std::string& str = ws[t].str;
+        FeatureId* f = ids + t * kNbTemplates;
+
+        uint64_t lower = kFnvBasis;
+        uint64_t prefix = kFnvBasis;
+        uint64_t suffix = kFnvBasis;
+        uint64_t shape = kFnvBasis;
+        char prev_class = 0;
+
+        // the affixes are cut on code points, not on bytes
+        size_t nb_chars = 0;
+        for (char c : str) {
+            nb_chars += IsLead(c) ? 1 : 0;
+        }
+        // code point str[i] belongs to
+        size_t ch = 0;
+
+        for (size_t i = 0; i < str.size(); ++i) {
+            bool lead = IsLead(str[i]);
+            if (lead && i > 0) {
+                ++ch;
+            }
+            unsigned char c = Lower(str, i);
+            lower = HashByte(lower, c);
+            if (ch < kAffixLength) {
+                prefix = HashByte(prefix, c);
+            }
+            if (ch + kAffixLength >= nb_chars) {
+                suffix = HashByte(suffix, c);
+            }
+            if (lead) {
+                char cls = ShapeClass(str, i);
+                if (cls != prev_class) {
+                    shape = HashByte(shape, cls);
+                    prev_class = cls;
+                }
+            }
+        }
+
+        f[kLowercase] = Mix(lower, kLowercase) % space;
+        f[kPrefix] = Mix(prefix, kPrefix) % space;
+        f[kSuffix] = Mix(suffix, kSuffix) % space;
+        f[kShape] = Mix(shape, kShape) % space;
+
+        // the lowercased word, seen from its neighbours
+        f[kPrevWord] = Mix(prev_lower, kPrevWord) % space;
+        if (t > 0) {
+            ids[(t - 1) * kNbTemplates + kNextWord] =
+                Mix(lower, kNextWord) % space;
+        }
+        prev_lower = lower;
+    }
+
+    if (!ws.empty()) {
+        ids[(ws.size() - 1) * kNbTemplates + kNextWord] =
+            Mix(kBoundary, kNextWord) % space;
+    }
+}
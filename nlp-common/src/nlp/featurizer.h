@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -9,4 +10,28 @@ struct FeaturesExtractor {
     static std::vector<WordFeatures> Do(const std::vector<std::string>& sentence);
 };
 
+typedef uint32_t FeatureId;
 
+// Hashed features of the words of a sentence: kNbTemplates ids per word, in
+// [0, space). Every id is hashed from the bytes of the sentence directly, no
+// string is built. Words are UTF-8: lowercasing only folds ASCII and Latin-1
+// letters, whatever the locale.
+struct FeatureTemplates {
+    enum {
+        kLowercase,
+        // first and last kAffixLength code points, lowercased
+        kPrefix,
+        kSuffix,
+        // classes of characters, runs merged: "McDonald's" is "XxXx'x"
+        kShape,
+        kPrevWord,
+        kNextWord,
+        kNbTemplates
+    };
+
+    static const size_t kAffixLength = 3;
+
+    // ids must hold ws.size() * kNbTemplates ids, word after word
+    static void Extract(
+            const std::vector<WordFeatures>& ws, size_t space, FeatureId* ids);
+};
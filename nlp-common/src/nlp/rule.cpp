@@ -1,5 +1,6 @@
 #include "rule.h"
 
+#include <algorithm>
 #include <sstream>
 #include <glog/logging.h>
 
@@ -20,54 +21,52 @@ Rule::Rule(const std::string& str) {
 }
 
 bool Rule::Matches(const TrainingExample& ex) const {
-    if (pattern_[0] == "^") {
-        return Matches(ex, 1, 0);
-    } else {
-        for (size_t i = 0; i < ex.inputs.size(); ++i) {
-            if (Matches(ex, 0, i)) {
-                return true;
-            }
-        }
-        return false;
-    }
+    std::vector<char> memo;
+    return Matches(ex, memo);
 }
 
-bool Rule::Matches(const TrainingExample& ex, size_t pidx, size_t exidx) const {
-    if (pattern_.size() <= pidx) {
-        // pattern consumed
-        return true;
-    }
+bool Rule::Matches(const TrainingExample& ex, std::vector<char>& memo) const {
+    const size_t n = ex.inputs.size();
+    const size_t stride = n + 1;
+    // memo[pidx * stride + exidx]: whether the pattern from pidx matches the
+    // input from exidx. Filled from the end of the pattern, so that each
+    // entry is computed once.
+    memo.assign((pattern_.size() + 1) * stride, false);
+    std::fill_n(memo.begin() + pattern_.size() * stride, stride, true);
 
-    if (pattern_[pidx] == "$") {
-        // check for end
-        return exidx == ex.inputs.size();
-    }
+    for (size_t pidx = pattern_.size(); pidx-- > 0;) {
+        const std::string& p = pattern_[pidx];
+        char* cur = &memo[pidx * stride];
+        const char* next = &memo[(pidx + 1) * stride];
 
-    if (ex.inputs.size() <= exidx) {
-        // input too short
-        return false;
-    }
+        if (p == "$") {
+            // check for end
+            cur[n] = true;
+            continue;
+        }
 
-    if (pattern_[pidx] == ex.inputs[exidx].str) {
-        // next word
-        return Matches(ex, pidx + 1, exidx + 1);
+        // whether the rest of the pattern matches from any exidx' in
+        // [exidx, n), for `*`
+        bool any_next = false;
+        for (size_t exidx = n; exidx-- > 0;) {
+            any_next = any_next || next[exidx];
+            if (p == ex.inputs[exidx].str || p == "_") {
+                // next word
+                cur[exidx] = next[exidx + 1];
+            } else if (p == "*") {
+                cur[exidx] = any_next;
+            }
+        }
     }
 
-    if (pattern_[pidx] == "_") {
-        // next word
-        return Matches(ex, pidx + 1, exidx + 1);
+    if (!pattern_.empty() && pattern_[0] == "^") {
+        return memo[stride];
     }
-
-    if (pattern_[pidx] == "*") {
-        while (exidx < ex.inputs.size()) {
-            if (Matches(ex, pidx + 1, exidx)) {
-                return true;
-            }
-            ++exidx;
+    for (size_t i = 0; i < n; ++i) {
+        if (memo[i]) {
+            return true;
         }
-        return false;
     }
-
     return false;
 }
 
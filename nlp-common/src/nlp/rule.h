@@ -9,12 +9,17 @@ class Rule {
     std::string key_;
     std::vector<std::string> pattern_;
 
-    bool Matches(const TrainingExample& ex, size_t pidx, size_t exidx) const;
-
   public:
     Rule(const std::string& str);
+
+    // Whether the pattern occurs in ex, in O(pattern x words) time whatever
+    // the number of `*`
     bool Matches(const TrainingExample& ex) const;
+    // Same, memo being the table of the dynamic programming, reused from one
+    // call to the next
+    bool Matches(const TrainingExample& ex, std::vector<char>& memo) const;
     const std::string& key() const { return key_; }
+    const std::vector<std::string>& pattern() const { return pattern_; }
 
     std::string AsString() const;
 };
@@ -1,24 +1,291 @@
 #include "rules-matcher.h"
 
+#include <algorithm>
 #include <sstream>
 
+RulesMatcher::RulesMatcher()
+        : nodes_(2), dict_version_(0), vocab_size_(0), unk_id_(kNoToken),
+        star_id_(kNoToken) {}
+
+void RulesMatcher::AddRule(const std::string& str, const Dictionnary& dict) {
+    rules_.emplace_back(str);
+    if (IsCompiledFor(dict)) {
+        Insert(rules_.back(), rules_.size() - 1, dict);
+    } else {
+        Compile(dict);
+    }
+}
+
+void RulesMatcher::Compile(const Dictionnary& dict) {
+    nodes_.assign(2, Node());
+    edges_.clear();
+    dead_.clear();
+    dict_version_ = dict.version();
+    vocab_size_ = dict.size();
+    unk_id_ = dict.unk_id();
+    star_id_ = Token(dict.FindWordId("*"));
+    for (size_t i = 0; i < rules_.size(); ++i) {
+        Insert(rules_[i], i, dict);
+    }
+}
+
+int RulesMatcher::Child(int node, uint32_t word) {
+    uint64_t edge = (uint64_t(node) << 32) | word;
+    auto child = edges_.find(edge);
+    if (child != edges_.end()) {
+        return child->second;
+    }
+
+    nodes_.emplace_back();
+    edges_[edge] = nodes_.size() - 1;
+    return nodes_.size() - 1;
+}
+
+void RulesMatcher::Insert(
+        const Rule& rule, size_t idx, const Dictionnary& dict) {
+    const auto& pattern = rule.pattern();
+    size_t i = 0;
+    int node = kRoot;
+    dead_.resize(rules_.size());
+    dead_[idx] = false;
+    if (!pattern.empty() && pattern[0] == "^") {
+        node = kAnchoredRoot;
+        i = 1;
+    }
+
+    for (; i < pattern.size(); ++i) {
+        const std::string& w = pattern[i];
+        int* special = nullptr;
+        if (w == "_") {
+            special = &nodes_[node].any;
+        } else if (w == "*") {
+            special = &nodes_[node].star;
+        } else if (w == "$") {
+            special = &nodes_[node].end;
+        }
+
+        if (!special) {
+            // a word out of the vocabulary leads to a node never reached
+            uint32_t tok = Token(dict.FindWordId(w));
+            dead_[idx] = dead_[idx] || tok == kNoToken;
+            node = Child(node, tok);
+        } else {
+            if (*special == -1) {
+                nodes_.emplace_back();
+                // nodes_ may have moved
+                special = w == "_" ? &nodes_[node].any
+                    : w == "*" ? &nodes_[node].star : &nodes_[node].end;
+                *special = nodes_.size() - 1;
+            }
+            node = *special;
+        }
+
+        if (w == "$") {
+            // the rest of the pattern is never looked at
+            break;
+        }
+    }
+    nodes_[node].rules.push_back(idx);
+}
+
+uint32_t RulesMatcher::Token(size_t idx) const {
+    // words learnt since the rules were compiled can't be in any rule
+    return idx == unk_id_ || idx >= vocab_size_ ? kNoToken : idx;
+}
+
+void RulesMatcher::Visit(
+        int start, size_t pos, size_t size, Scratch& scratch) const {
+    // the nodes reached through a `*` without consuming a word are visited
+    // at the same position
+    std::vector<int>& todo = scratch.active;
+    todo.push_back(start);
+    while (!todo.empty()) {
+        int idx = todo.back();
+        todo.pop_back();
+        if (scratch.seen[idx] == scratch.stamp) {
+            continue;
+        }
+        scratch.seen[idx] = scratch.stamp;
+
+        const Node& node = nodes_[idx];
+        scratch.matched.insert(scratch.matched.end(),
+                node.rules.begin(), node.rules.end());
+
+        if (pos == size) {
+            if (node.end != -1) {
+                const auto& rules = nodes_[node.end].rules;
+                scratch.matched.insert(scratch.matched.end(),
+                        rules.begin(), rules.end());
+            }
+            continue;
+        }
+
+        uint32_t tok = scratch.tokens[pos];
+        if (tok != kNoToken) {
+            auto child = edges_.find((uint64_t(idx) << 32) | tok);
+            if (child != edges_.end()) {
+                scratch.next.push_back(child->second);
+            }
+        }
+
+        if (node.any != -1) {
+            scratch.next.push_back(node.any);
+        }
+
+        if (node.star != -1) {
+            if (tok == star_id_ && tok != kNoToken) {
+                // a literal "*" is matched as a word
+                scratch.next.push_back(node.star);
+            } else {
+                todo.push_back(node.star);
+                if (scratch.star_seen[node.star] != scratch.stamp) {
+                    scratch.star_seen[node.star] = scratch.stamp;
+                    scratch.next_stars.push_back(node.star);
+                }
+            }
+        }
+    }
+}
+
+const std::vector<size_t>& RulesMatcher::Match(
+        const TrainingExample& str, Scratch& scratch) const {
+    const size_t size = str.inputs.size();
+    scratch.tokens.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+        scratch.tokens[i] = Token(str.inputs[i].idx);
+    }
+
+    if (scratch.seen.size() < nodes_.size()) {
+        scratch.seen.resize(nodes_.size(), 0);
+        scratch.star_seen.resize(nodes_.size(), 0);
+    }
+    scratch.active.clear();
+    scratch.next.clear();
+    scratch.stars.clear();
+    scratch.next_stars.clear();
+    scratch.matched.clear();
+
+    std::vector<int>& reached = scratch.reached;
+    reached.clear();
+    for (size_t pos = 0; pos <= size; ++pos) {
+        ++scratch.stamp;
+        std::swap(scratch.next, reached);
+        scratch.next.clear();
+        std::swap(scratch.next_stars, scratch.stars);
+        scratch.next_stars.clear();
+
+        if (pos == 0) {
+            Visit(kAnchoredRoot, pos, size, scratch);
+        }
+        if (pos < size) {
+            // a `*` can be repeated while a word remains
+            for (int star : scratch.stars) {
+                if (scratch.star_seen[star] != scratch.stamp) {
+                    scratch.star_seen[star] = scratch.stamp;
+                    scratch.next_stars.push_back(star);
+                }
+                Visit(star, pos, size, scratch);
+            }
+            // unanchored rules may start at any word
+            Visit(kRoot, pos, size, scratch);
+        }
+        for (int node : reached) {
+            Visit(node, pos, size, scratch);
+        }
+        reached.clear();
+    }
+
+    std::sort(scratch.matched.begin(), scratch.matched.end());
+    scratch.matched.erase(
+            std::unique(scratch.matched.begin(), scratch.matched.end()),
+            scratch.matched.end());
+    return scratch.matched;
+}
+
 std::vector<std::string> RulesMatcher::Match(const TrainingExample& str) const {
+    Scratch scratch;
     std::vector<std::string> matches;
+    for (size_t r : Match(str, scratch)) {
+        matches.push_back(rules_[r].key());
+    }
+    return matches;
+}
 
-    for (auto& r : rules_) {
-        if (r.Matches(str)) {
-            matches.push_back(r.key());
+RulesMatcher::Matches RulesMatcher::MatchAll(
+        const Document& doc, ad::ThreadPool& pool) const {
+    const size_t nb_examples = doc.examples.size();
+    const int nb_chunks = (nb_examples + kMatchChunk - 1) / kMatchChunk;
+
+    // rules matched by the examples of each chunk, and their number per
+    // example
+    std::vector<std::vector<uint32_t>> chunk_rules(nb_chunks);
+    std::vector<std::vector<uint32_t>> chunk_counts(nb_chunks);
+    pool.ParallelFor(nb_chunks, [&](int chunk) {
+        size_t begin = chunk * kMatchChunk;
+        size_t end = std::min(begin + kMatchChunk, nb_examples);
+        Scratch scratch;
+        auto& rules = chunk_rules[chunk];
+        auto& counts = chunk_counts[chunk];
+        counts.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            const auto& matched = Match(doc.examples[i], scratch);
+            rules.insert(rules.end(), matched.begin(), matched.end());
+            counts.push_back(matched.size());
         }
+    });
+
+    std::vector<size_t> chunk_offsets(nb_chunks + 1, 0);
+    for (int c = 0; c < nb_chunks; ++c) {
+        chunk_offsets[c + 1] = chunk_offsets[c] + chunk_rules[c].size();
     }
-    return matches;
+
+    Matches res;
+    res.offsets.resize(nb_examples + 1);
+    res.offsets[nb_examples] = chunk_offsets[nb_chunks];
+    res.rules.resize(chunk_offsets[nb_chunks]);
+
+    // each shard gathers a range of chunks and counts their matches
+    const int nb_shards = std::min(pool.size() + 1, std::max(nb_chunks, 1));
+    std::vector<std::vector<size_t>> coverages(
+            nb_shards, std::vector<size_t>(rules_.size(), 0));
+    pool.ParallelFor(nb_shards, [&](int shard) {
+        auto& coverage = coverages[shard];
+        int begin = nb_chunks * shard / nb_shards;
+        int end = nb_chunks * (shard + 1) / nb_shards;
+        for (int c = begin; c < end; ++c) {
+            size_t offset = chunk_offsets[c];
+            size_t example = c * kMatchChunk;
+            for (uint32_t count : chunk_counts[c]) {
+                res.offsets[example++] = offset;
+                offset += count;
+            }
+
+            std::copy(chunk_rules[c].begin(), chunk_rules[c].end(),
+                    res.rules.begin() + chunk_offsets[c]);
+            for (uint32_t r : chunk_rules[c]) {
+                ++coverage[r];
+            }
+            std::vector<uint32_t>().swap(chunk_rules[c]);
+        }
+    });
+
+    res.coverage = std::move(coverages[0]);
+    for (int shard = 1; shard < nb_shards; ++shard) {
+        for (size_t r = 0; r < rules_.size(); ++r) {
+            res.coverage[r] += coverages[shard][r];
+        }
+    }
+    return res;
 }
 
-RulesMatcher RulesMatcher::FromSerialized(const std::string& str) {
+RulesMatcher RulesMatcher::FromSerialized(
+        const std::string& str, const Dictionnary& dict) {
     RulesMatcher rm;
+    rm.Compile(dict);
     std::istringstream iss(str);
     std::string line;
     while (std::getline(iss, line)) {
-        rm.AddRule(line);
+        rm.AddRule(line, dict);
     }
     return rm;
 }
@@ -1,24 +1,135 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <unordered_map>
 
+#include <ad/thread_pool.h>
+
+#include "dict.h"
 #include "rule.h"
 
+// Matches every rule in a single left-to-right pass over the sentence. The
+// rules are compiled, as they are added, into a trie of the ids of their words
+// in a Dictionnary, whose nodes also have edges for `_`, `*` and `$`, rules
+// starting with `^` having a root of their own. Matching follows the set of
+// nodes reachable at each word of a sentence annotated with the same
+// Dictionnary, comparing ids only, so common prefixes and start offsets are
+// shared by every rule, with the same results as Rule::Matches(). A word of a
+// rule missing from the vocabulary never matches, until the rules are
+// compiled again against a vocabulary containing it.
 class RulesMatcher {
+  public:
+    // Buffers of Match(), reused from one call to the next. A scratch must
+    // only be used by one thread at a time.
+    struct Scratch {
+        // ids of the words of the sentence, kNoToken for the words no rule
+        // can match
+        std::vector<uint32_t> tokens;
+        // nodes reached at the current and next word
+        std::vector<int> active;
+        std::vector<int> next;
+        // nodes reached at the current word, still to visit
+        std::vector<int> reached;
+        // `*` being repeated over the next word
+        std::vector<int> stars;
+        std::vector<int> next_stars;
+        // when a node was last reached, or a `*` last repeated
+        std::vector<size_t> seen;
+        std::vector<size_t> star_seen;
+        size_t stamp = 0;
+        std::vector<size_t> matched;
+    };
+
+    // Rules matching each example of a corpus, as a sparse boolean matrix:
+    // the rules matching example i are rules[offsets[i] .. offsets[i + 1]),
+    // in increasing order
+    struct Matches {
+        std::vector<size_t> offsets;
+        std::vector<uint32_t> rules;
+        // number of examples matched by each rule
+        std::vector<size_t> coverage;
+    };
+
+  private:
+    // examples matched by a task of MatchAll()
+    static const size_t kMatchChunk = 1024;
+
+    struct Node {
+        // rules whose pattern ends here
+        std::vector<size_t> rules;
+        // children on `_`, `*` and `$`, -1 if none
+        int any = -1;
+        int star = -1;
+        int end = -1;
+    };
+
+    static const int kRoot = 0;
+    static const int kAnchoredRoot = 1;
+    // id of the words out of the vocabulary the rules were compiled with,
+    // never matched
+    static const uint32_t kNoToken = -1;
+
     std::vector<Rule> rules_;
+    // whether each rule has a word out of the vocabulary
+    std::vector<bool> dead_;
+    std::vector<Node> nodes_;
+    // (node << 32 | word id) -> child, for the literal words
+    std::unordered_map<uint64_t, int> edges_;
+
+    // the vocabulary the rules were compiled with
+    uint64_t dict_version_;
+    size_t vocab_size_;
+    uint32_t unk_id_;
+    // id of "*", matched by a `*` as a word
+    uint32_t star_id_;
+
+    void Insert(const Rule& rule, size_t idx, const Dictionnary& dict);
+    int Child(int node, uint32_t word);
+    uint32_t Token(size_t idx) const;
+    // Reaches node at word pos of a sentence of size words
+    void Visit(int node, size_t pos, size_t size, Scratch& scratch) const;
 
   public:
-    void AddRule(const std::string& str) { rules_.emplace_back(str); }
+    RulesMatcher();
 
+    // Adds a rule, compiled against dict. The other rules are compiled again
+    // if dict is not the vocabulary they were compiled with.
+    void AddRule(const std::string& str, const Dictionnary& dict);
+
+    // Compiles the rules again, to be called whenever the vocabulary changes
+    void Compile(const Dictionnary& dict);
+    // Whether the rules were compiled with dict as it is now, or with a copy
+    // of it
+    bool IsCompiledFor(const Dictionnary& dict) const {
+        return dict.version() == dict_version_;
+    }
+
+    // Keys of the rules matching str, in the order of the rules. The idx of
+    // the words of str are their ids in the vocabulary the rules were
+    // compiled with.
     std::vector<std::string> Match(const TrainingExample& str) const;
+    // Same, with caller buffers. Returns the indices of the rules matching
+    // str, in order, in scratch.matched.
+    const std::vector<size_t>& Match(
+            const TrainingExample& str, Scratch& scratch) const;
+
+    // Matches every example of doc, in chunks split between the threads of
+    // pool
+    Matches MatchAll(const Document& doc, ad::ThreadPool& pool) const;
 
     size_t size() const { return rules_.size(); }
+    const Rule& rule(size_t i) const { return rules_[i]; }
+    // Whether rule i has a word out of the vocabulary it was compiled with,
+    // and thus never matches
+    bool IsDead(size_t i) const { return dead_[i]; }
 
     std::vector<Rule>::iterator begin() { return rules_.begin(); }
     std::vector<Rule>::iterator end() { return rules_.end(); }
 
-    static RulesMatcher FromSerialized(const std::string& str);
+    static RulesMatcher FromSerialized(
+            const std::string& str, const Dictionnary& dict);
 
     std::string Serialize() const;
 };
@@ -1,71 +1,113 @@
 #include <glog/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <ad/kernels.h>
 
 #include "sequence-tagger.h"
 
 static const unsigned int kNotFound = -1;
 static constexpr double kLearningRate = 0.01;
+static constexpr double kCrfLearningRate = 0.05;
+static constexpr size_t kCrfBatchSize = 32;
+static constexpr double kImpossible = -std::numeric_limits<double>::infinity();
+
+// First line of a serialized tagger. Version 1, saved without this line, has
+// the word weights and the transitions. Version 2, also without it, adds the
+// feature space to the header and the hashed features' weights at the end.
+static const char kFormatMagic[] = "sequence-tagger";
+static constexpr int kFormatVersion = 3;
 
 SequenceTagger::SequenceTagger(
             size_t in_sz, size_t out_sz,
             size_t start_word, size_t start_label,
-            size_t stop_word, size_t stop_label)
-        : input_size_(in_sz),
+            size_t stop_word, size_t stop_label,
+            size_t feature_space)
+        : feature_space_(feature_space),
+        input_size_(in_sz),
         output_size_(out_sz),
         start_word_(start_word),
         start_label_(start_label),
         stop_word_(stop_word),
-        stop_label_(stop_label) {
+        stop_label_(stop_label),
+        nb_successors_(0) {
+    Init();
 }
 
 SequenceTagger::SequenceTagger()
-        : input_size_(0),
-        output_size_(0) {
+        : feature_space_(0),
+        input_size_(0),
+        output_size_(0),
+        start_word_(kNotFound),
+        start_label_(kNotFound),
+        stop_word_(kNotFound),
+        stop_label_(kNotFound),
+        nb_successors_(0) {
 }
 
 void SequenceTagger::Init() {
-    word_weight_.resize(output_size_);
-    for (size_t i = 0; i < output_size_; ++i) {
-        word_weight_[i].resize(input_size_);
-        for (size_t j = 0; j < input_size_; ++j) {
-            word_weight_[i][j] = 0;
+    word_weight_.setZero(output_size_, input_size_);
+    state_transition_.setZero(output_size_, output_size_);
+    feature_weight_.setZero(output_size_, feature_space_);
+    SortTransitions();
+}
+
+void SequenceTagger::SortTransitions() {
+    std::vector<Label> labels;
+    for (size_t k = 0; k < output_size_; ++k) {
+        if (k != start_label_ && k != stop_label_) {
+            labels.push_back(k);
         }
     }
-    state_transition_.resize(output_size_);
-    for (size_t i = 0; i < output_size_; ++i) {
-        state_transition_[i].resize(output_size_);
-        for (size_t j = 0; j < output_size_; ++j) {
-            state_transition_[i][j] = 0;
-        }
+
+    nb_successors_ = labels.size();
+    successors_.resize(output_size_ * nb_successors_);
+    for (size_t prev = 0; prev < output_size_; ++prev) {
+        auto trans = state_transition_.col(prev);
+        auto row = successors_.begin() + prev * nb_successors_;
+        std::copy(labels.begin(), labels.end(), row);
+        std::stable_sort(row, row + nb_successors_, [&](Label a, Label b) {
+            return trans(a) > trans(b);
+        });
     }
 }
 
-double SequenceTagger::WordF(Label target, const WordFeatures& w) const {
-    if (w.idx == kNotFound)
-        return 0;
-
-    return word_weight_[target][w.idx];
+void SequenceTagger::ExtractFeatures(
+        const std::vector<WordFeatures>& ws,
+        std::vector<FeatureId>& ids) const {
+    ids.resize(ws.size() * nb_features());
+    if (feature_space_) {
+        FeatureTemplates::Extract(ws, feature_space_, ids.data());
+    }
 }
 
-void SequenceTagger::WordF_Backprop(
-        const WordFeatures& w,
-        Label truth,
-        const double* probabilities) {
-    if (w.idx == kNotFound)
-        return;
+void SequenceTagger::WordScores(
+        size_t word, const FeatureId* features, double* scores) const {
+    Eigen::Map<Eigen::VectorXd> out(scores, output_size_);
+    if (word == kNotFound) {
+        out.setZero();
+    } else {
+        out = word_weight_.col(word);
+    }
 
-    for (size_t k = 0; k < output_size_; ++k) {
-        double target = (truth == k) ? 1 : 0;
-        word_weight_[k][w.idx] += kLearningRate * (target - probabilities[k]);
+    if (features) {
+        for (size_t f = 0; f < nb_features(); ++f) {
+            out += feature_weight_.col(features[f]);
+        }
     }
 }
 
-double SequenceTagger::RunAllFeatures(
-        Label k,
-        const WordFeatures& w,
-        const WordFeatures& /* prev */) const {
-    double sum = 0;
-    sum += WordF(k, w);
-    return sum;
+void SequenceTagger::Emissions(
+        size_t word, const FeatureId* features, double* scores) const {
+    WordScores(word, features, scores);
+
+    if (start_label_ < output_size_) {
+        scores[start_label_] = kImpossible;
+    }
+    if (stop_label_ < output_size_) {
+        scores[stop_label_] = kImpossible;
+    }
 }
 
 double SequenceTagger::ComputeNLL(double* probas) const {
@@ -77,47 +119,272 @@ double SequenceTagger::ComputeNLL(double* probas) const {
 }
 
 Label SequenceTagger::ComputeTagForWord(
-        const WordFeatures& w,
-        const WordFeatures& prev,
+        size_t word,
+        const FeatureId* features,
+        Label prev,
         double* probabilities) const {
-    double total = 0;
-    for (size_t k = 0; k < output_size_; ++k) {
-        probabilities[k] = std::exp(RunAllFeatures(k, w, prev));
-        total += probabilities[k];
+    Eigen::Map<Eigen::VectorXd> probas(probabilities, output_size_);
+    WordScores(word, features, probabilities);
+    probas += state_transition_.col(prev);
+    probas = probas.array().exp();
+    probas /= probas.sum();
+
+    Eigen::VectorXd::Index max;
+    probas.maxCoeff(&max);
+    return max;
+}
+
+void SequenceTagger::Compute(
+        std::vector<WordFeatures>& ws,
+        const DecodeOptions& opts) {
+    tags_.resize(ws.size());
+    Tag(ws, tags_.data(), scratch_, opts);
+    for (size_t i = 0; i < ws.size(); ++i) {
+        ws[i].pos = tags_[i];
     }
+}
 
-    int max = 0;
-    for (size_t k = 0; k < output_size_; ++k) {
-        probabilities[k] /= total;
-        if (probabilities[k] > probabilities[max]) {
-            max = k;
+void SequenceTagger::Tag(
+        const std::vector<WordFeatures>& ws,
+        Label* tags,
+        Scratch& scratch,
+        const DecodeOptions& opts) const {
+    size_t beam_width = opts.beam_width ? opts.beam_width : nb_successors_;
+    size_t top_k = opts.top_k_transitions ? opts.top_k_transitions
+        : nb_successors_;
+
+    if (beam_width >= nb_successors_ && top_k >= nb_successors_) {
+        Viterbi(ws, tags, scratch);
+    } else {
+        BeamSearch(ws, tags, scratch,
+                std::min(beam_width, nb_successors_),
+                std::min(top_k, nb_successors_));
+    }
+}
+
+void SequenceTagger::Viterbi(
+        const std::vector<WordFeatures>& ws,
+        Label* tags,
+        Scratch& scratch) const {
+    const size_t n = ws.size();
+    const size_t nb_labels = output_size_;
+    if (n == 0 || nb_labels == 0) {
+        return;
+    }
+
+    scratch.lattice.resize(n * nb_labels);
+    scratch.backpointers.resize(n * nb_labels);
+    scratch.emissions.resize(nb_labels);
+    ExtractFeatures(ws, scratch.features);
+    const FeatureId* features = scratch.features.data();
+
+    double* first = scratch.lattice.data();
+    Emissions(ws[0].idx, features, first);
+    if (start_label_ < nb_labels) {
+        const double* from_start = state_transition_.col(start_label_).data();
+        for (size_t k = 0; k < nb_labels; ++k) {
+            first[k] += from_start[k];
         }
     }
-    return max;
+
+    for (size_t t = 1; t < n; ++t) {
+        const double* prev = scratch.lattice.data() + (t - 1) * nb_labels;
+        double* cur = scratch.lattice.data() + t * nb_labels;
+        double* from = scratch.backpointers.data() + t * nb_labels;
+        std::fill(cur, cur + nb_labels, kImpossible);
+        std::fill(from, from + nb_labels, 0);
+
+        // one column of transitions at a time: every label is updated at
+        // once by the vectorized kernel
+        for (size_t i = 0; i < nb_labels; ++i) {
+            if (prev[i] == kImpossible) {
+                continue;
+            }
+            ad::kernels::MaxPlus(state_transition_.col(i).data(), prev[i], i,
+                    cur, from, nb_labels);
+        }
+
+        Emissions(ws[t].idx, features + t * nb_features(),
+                scratch.emissions.data());
+        for (size_t k = 0; k < nb_labels; ++k) {
+            cur[k] += scratch.emissions[k];
+        }
+    }
+
+    const double* last = scratch.lattice.data() + (n - 1) * nb_labels;
+    size_t best = 0;
+    double best_score = kImpossible;
+    for (size_t k = 0; k < nb_labels; ++k) {
+        double s = last[k];
+        if (stop_label_ < nb_labels) {
+            s += state_transition_(stop_label_, k);
+        }
+        if (s > best_score) {
+            best_score = s;
+            best = k;
+        }
+    }
+
+    for (size_t t = n; t-- > 0;) {
+        tags[t] = best;
+        best = static_cast<size_t>(scratch.backpointers[t * nb_labels + best]);
+    }
 }
 
-// TODO: Implement Viterbi!
-void SequenceTagger::Compute(std::vector<WordFeatures>& ws) {
-    WordFeatures prev("*");
-    prev.idx = start_word_;
-    prev.pos = start_label_;
+void SequenceTagger::BeamSearch(
+        const std::vector<WordFeatures>& ws,
+        Label* tags,
+        Scratch& scratch,
+        size_t beam_width,
+        size_t top_k) const {
+    const size_t n = ws.size();
+    if (n == 0 || nb_successors_ == 0) {
+        return;
+    }
+
+    scratch.beam_labels.resize(n * beam_width);
+    scratch.beam_from.resize(n * beam_width);
+    scratch.beam_sizes.resize(n);
+    scratch.beam_scores.resize(beam_width);
+    scratch.next_scores.resize(beam_width);
+    if (scratch.candidate_scores.size() != output_size_) {
+        scratch.candidate_scores.assign(output_size_, kImpossible);
+        scratch.candidate_from.resize(output_size_);
+    }
+    scratch.candidates.clear();
+    scratch.emissions.resize(output_size_);
+    ExtractFeatures(ws, scratch.features);
+
+    const double* emissions = scratch.emissions.data();
+    // Extends the hypothesis from, ending on prev, with the top_k best
+    // successors of prev, keeping the best extension of each label
+    auto expand = [&](size_t prev, size_t nb_next, double score, size_t from) {
+        const Label* next = successors_.data() + prev * nb_successors_;
+        const double* trans = state_transition_.col(prev).data();
+        for (size_t i = 0; i < nb_next; ++i) {
+            Label k = next[i];
+            double s = score + trans[k] + emissions[k];
+            if (scratch.candidate_scores[k] == kImpossible) {
+                scratch.candidates.push_back(k);
+            }
+            if (s > scratch.candidate_scores[k]) {
+                scratch.candidate_scores[k] = s;
+                scratch.candidate_from[k] = from;
+            }
+        }
+    };
+
+    for (size_t t = 0; t < n; ++t) {
+        WordScores(ws[t].idx, scratch.features.data() + t * nb_features(),
+                scratch.emissions.data());
+
+        if (t > 0) {
+            const Label* labels = scratch.beam_labels.data() + (t - 1) * beam_width;
+            for (size_t j = 0; j < scratch.beam_sizes[t - 1]; ++j) {
+                expand(labels[j], top_k, scratch.beam_scores[j], j);
+            }
+        } else if (start_label_ < output_size_) {
+            expand(start_label_, top_k, 0, 0);
+        } else {
+            // no START transition: every label, scored by the word only.
+            // Any row of successors_ lists them all.
+            for (size_t i = 0; i < nb_successors_; ++i) {
+                Label k = successors_[i];
+                scratch.candidates.push_back(k);
+                scratch.candidate_scores[k] = emissions[k];
+                scratch.candidate_from[k] = 0;
+            }
+        }
 
-    std::vector<double> probas(output_size_);
+        if (scratch.candidates.size() > beam_width) {
+            std::nth_element(scratch.candidates.begin(),
+                    scratch.candidates.begin() + beam_width, scratch.candidates.end(),
+                    [&](Label a, Label b) {
+                        return scratch.candidate_scores[a] > scratch.candidate_scores[b];
+                    });
+        }
 
-    for (auto& w : ws) {
-        w.pos = ComputeTagForWord(w, prev, probas.data());
+        size_t size = std::min(beam_width, scratch.candidates.size());
+        Label* labels = scratch.beam_labels.data() + t * beam_width;
+        size_t* from = scratch.beam_from.data() + t * beam_width;
+        for (size_t j = 0; j < size; ++j) {
+            Label k = scratch.candidates[j];
+            labels[j] = k;
+            from[j] = scratch.candidate_from[k];
+            scratch.next_scores[j] = scratch.candidate_scores[k];
+        }
+        scratch.beam_sizes[t] = size;
 
-        prev = w;
+        for (Label k : scratch.candidates) {
+            scratch.candidate_scores[k] = kImpossible;
+        }
+        scratch.candidates.clear();
+        std::swap(scratch.beam_scores, scratch.next_scores);
     }
-    // FIXME: Use STOP for Viterbi
+
+    const Label* last = scratch.beam_labels.data() + (n - 1) * beam_width;
+    size_t best = 0;
+    double best_score = kImpossible;
+    for (size_t j = 0; j < scratch.beam_sizes[n - 1]; ++j) {
+        double s = scratch.beam_scores[j];
+        if (stop_label_ < output_size_) {
+            s += state_transition_(stop_label_, last[j]);
+        }
+        if (s > best_score) {
+            best_score = s;
+            best = j;
+        }
+    }
+
+    for (size_t t = n; t-- > 0;) {
+        tags[t] = scratch.beam_labels[t * beam_width + best];
+        best = scratch.beam_from[t * beam_width + best];
+    }
+}
+
+void SequenceTagger::TagBatch(
+        const std::vector<std::vector<WordFeatures>>& sentences,
+        const std::vector<Label*>& tags,
+        ad::ThreadPool& pool,
+        const DecodeOptions& opts) const {
+    LOG_IF(FATAL, tags.size() != sentences.size())
+        << "TagBatch: " << sentences.size() << " sentences but "
+        << tags.size() << " tag arrays";
+    const int nb_shards = pool.size() + 1;
+    std::vector<Scratch> scratches(nb_shards);
+    pool.ParallelFor(nb_shards, [&](int idx) {
+        size_t begin = sentences.size() * idx / nb_shards;
+        size_t end = sentences.size() * (idx + 1) / nb_shards;
+        for (size_t i = begin; i < end; ++i) {
+            Tag(sentences[i], tags[i], scratches[idx], opts);
+        }
+    });
 }
 
 void SequenceTagger::Backprop(
-        const WordFeatures& w,
-        const WordFeatures& /* prev */,
+        size_t word,
+        const FeatureId* features,
+        Label prev,
         Label truth,
         const double* probabilities) {
-    WordF_Backprop(w, truth, probabilities);
+    // kLearningRate * (onehot(truth) - probabilities)
+    Eigen::VectorXd::ConstMapType probas(probabilities, output_size_);
+    auto step = -kLearningRate * probas;
+
+    if (word != kNotFound) {
+        word_weight_.col(word) += step;
+        word_weight_(truth, word) += kLearningRate;
+    }
+
+    if (features) {
+        for (size_t f = 0; f < nb_features(); ++f) {
+            feature_weight_.col(features[f]) += step;
+            feature_weight_(truth, features[f]) += kLearningRate;
+        }
+    }
+
+    state_transition_.col(prev) += step;
+    state_transition_(truth, prev) += kLearningRate;
 }
 
 int SequenceTagger::Train(const Document& doc) {
@@ -125,53 +392,224 @@ int SequenceTagger::Train(const Document& doc) {
     std::vector<double> probas(output_size_);
     int nb_correct = 0;
     int nb_tokens = 0;
-
-    word_weight_.resize(output_size_);
-    for (size_t i = 0; i < output_size_; ++i) {
-        word_weight_[i].resize(input_size_);
-    }
-
-    state_transition_.resize(output_size_);
-    for (size_t i = 0; i < output_size_; ++i) {
-        state_transition_[i].resize(output_size_);
-    }
-
-    std::cout << "dims: " << input_size_ << " " << output_size_ << std::endl;
+    std::vector<FeatureId> features;
 
     for (auto& ex : doc.examples) {
-        WordFeatures prev("*");
-        prev.idx = start_word_;
-        prev.pos = start_label_;
-        for (auto& w : ex.inputs) {
-            Label predicted = ComputeTagForWord(w, prev, probas.data());
+        ExtractFeatures(ex.inputs, features);
+        Label prev = start_label_;
+        for (size_t t = 0; t < ex.inputs.size(); ++t) {
+            const WordFeatures& w = ex.inputs[t];
+            const FeatureId* feats = features.data() + t * nb_features();
+            Label predicted =
+                ComputeTagForWord(w.idx, feats, prev, probas.data());
             nb_correct += predicted == w.pos ? 1 : 0;
             ++nb_tokens;
 
             nll += ComputeNLL(probas.data());
 
-            Backprop(w, prev, w.pos, probas.data());
-            prev = w;
+            Backprop(w.idx, feats, prev, w.pos, probas.data());
+            prev = w.pos;
         }
-        WordFeatures end("_END_");
-        end.idx = stop_word_;
-        end.pos = stop_label_;
 
-        Label predicted = ComputeTagForWord(end, prev, probas.data());
+        Label predicted =
+            ComputeTagForWord(stop_word_, nullptr, prev, probas.data());
         nb_correct += predicted == stop_label_ ? 1 : 0;
         ++nb_tokens;
 
         nll += ComputeNLL(probas.data());
 
-        Backprop(end, prev, stop_label_, probas.data());
+        Backprop(stop_word_, nullptr, prev, stop_label_, probas.data());
     }
+    SortTransitions();
     return  nb_correct * 100 / nb_tokens;
 }
 
+void SequenceTagger::CrfAccumulate(
+        const TrainingExample& ex,
+        const Eigen::MatrixXd& exp_trans,
+        CrfShard& shard) const {
+    const size_t n = ex.inputs.size();
+    const size_t nb_labels = output_size_;
+    if (n == 0) {
+        return;
+    }
+
+    auto& psi = shard.psi;
+    auto& alpha = shard.alpha;
+    auto& beta = shard.beta;
+    auto& reached = shard.reached;
+    psi.resize(nb_labels, n);
+    alpha.resize(nb_labels, n);
+    beta.resize(nb_labels, n);
+    reached.resize(nb_labels, n - 1);
+
+    ExtractFeatures(ex.inputs, shard.feature_ids);
+    const size_t nb_feats = nb_features();
+    for (size_t t = 0; t < n; ++t) {
+        Emissions(ex.inputs[t].idx, shard.feature_ids.data() + t * nb_feats,
+                psi.col(t).data());
+        double max = psi.col(t).maxCoeff();
+        // START and STOP get exp(-inf) = 0
+        psi.col(t) = (psi.col(t).array() - max).exp();
+    }
+
+    if (start_label_ < nb_labels) {
+        alpha.col(0) = exp_trans.col(start_label_).cwiseProduct(psi.col(0));
+    } else {
+        alpha.col(0) = psi.col(0);
+    }
+    alpha.col(0) /= alpha.col(0).sum();
+    for (size_t t = 1; t < n; ++t) {
+        reached.col(t - 1).noalias() = exp_trans * alpha.col(t - 1);
+        alpha.col(t) = reached.col(t - 1).cwiseProduct(psi.col(t));
+        alpha.col(t) /= alpha.col(t).sum();
+    }
+
+    if (stop_label_ < nb_labels) {
+        beta.col(n - 1) = exp_trans.row(stop_label_).transpose();
+    } else {
+        beta.col(n - 1).setOnes();
+    }
+    beta.col(n - 1) /= beta.col(n - 1).sum();
+    for (size_t t = n - 1; t > 0; --t) {
+        shard.marginal = psi.col(t).cwiseProduct(beta.col(t));
+        beta.col(t - 1).noalias() = exp_trans.transpose() * shard.marginal;
+        beta.col(t - 1) /= beta.col(t - 1).sum();
+    }
+
+    // gradient of the log-likelihood: observed counts minus expected counts
+    auto& trans = shard.transitions;
+    for (size_t t = 0; t < n; ++t) {
+        const WordFeatures& w = ex.inputs[t];
+        shard.marginal = alpha.col(t).cwiseProduct(beta.col(t));
+        shard.marginal /= shard.marginal.sum();
+
+        Eigen::VectorXd::Index predicted;
+        shard.marginal.maxCoeff(&predicted);
+        shard.nb_correct += (size_t)predicted == w.pos ? 1 : 0;
+        ++shard.nb_tokens;
+
+        if (w.idx != kNotFound) {
+            if (!shard.is_touched[w.idx]) {
+                shard.is_touched[w.idx] = true;
+                shard.touched.push_back(w.idx);
+            }
+            shard.words.col(w.idx) -= shard.marginal;
+            shard.words(w.pos, w.idx) += 1;
+        }
+
+        for (size_t f = 0; f < nb_feats; ++f) {
+            FeatureId id = shard.feature_ids[t * nb_feats + f];
+            if (!shard.is_touched_feature[id]) {
+                shard.is_touched_feature[id] = true;
+                shard.touched_features.push_back(id);
+            }
+            shard.features.col(id) -= shard.marginal;
+            shard.features(w.pos, id) += 1;
+        }
+
+        if (t == 0 && start_label_ < nb_labels) {
+            trans.col(start_label_) -= shard.marginal;
+            trans(w.pos, start_label_) += 1;
+        }
+        if (t > 0) {
+            trans(w.pos, ex.inputs[t - 1].pos) += 1;
+        }
+        if (t == n - 1 && stop_label_ < nb_labels) {
+            trans.row(stop_label_) -= shard.marginal.transpose();
+            trans(stop_label_, w.pos) += 1;
+        }
+    }
+
+    // The marginal of the labels (k, i) at (t, t - 1) is proportional to
+    // psi_t(k) beta_t(k) exp_trans(k, i) alpha_{t - 1}(i), whose sum is
+    // (psi_t .* beta_t) . reached_{t - 1}. Summed over t, the expected counts
+    // are one matrix product.
+    if (n > 1) {
+        auto& right = shard.weighted_beta;
+        right = psi.rightCols(n - 1).cwiseProduct(beta.rightCols(n - 1));
+        for (size_t t = 0; t < n - 1; ++t) {
+            right.col(t) /= right.col(t).dot(reached.col(t));
+        }
+        shard.pair_marginals.noalias() =
+            right * alpha.leftCols(n - 1).transpose();
+        trans -= shard.pair_marginals.cwiseProduct(exp_trans);
+    }
+}
+
+int SequenceTagger::TrainCRF(const Document& doc, ad::ThreadPool* pool) {
+    const int nb_shards = pool ? pool->size() + 1 : 1;
+    crf_shards_.resize(nb_shards);
+    for (auto& shard : crf_shards_) {
+        shard.words.setZero(output_size_, input_size_);
+        shard.touched.clear();
+        shard.is_touched.assign(input_size_, false);
+        shard.features.setZero(output_size_, feature_space_);
+        shard.touched_features.clear();
+        shard.is_touched_feature.assign(feature_space_, false);
+        shard.transitions.setZero(output_size_, output_size_);
+        shard.nb_correct = 0;
+        shard.nb_tokens = 0;
+    }
+
+    Eigen::MatrixXd exp_trans;
+    for (size_t begin = 0; begin < doc.examples.size(); begin += kCrfBatchSize) {
+        size_t end = std::min(begin + kCrfBatchSize, doc.examples.size());
+
+        // shifted by the max so that exp() cannot overflow
+        exp_trans = (state_transition_.array()
+                - state_transition_.maxCoeff()).exp();
+
+        auto run_shard = [&](int idx) {
+            size_t from = begin + (end - begin) * idx / nb_shards;
+            size_t to = begin + (end - begin) * (idx + 1) / nb_shards;
+            for (size_t i = from; i < to; ++i) {
+                CrfAccumulate(doc.examples[i], exp_trans, crf_shards_[idx]);
+            }
+        };
+        if (pool) {
+            pool->ParallelFor(nb_shards, run_shard);
+        } else {
+            run_shard(0);
+        }
+
+        // in the order of the shards, whatever the threads' scheduling
+        for (auto& shard : crf_shards_) {
+            for (size_t w : shard.touched) {
+                word_weight_.col(w) += kCrfLearningRate * shard.words.col(w);
+                shard.words.col(w).setZero();
+                shard.is_touched[w] = false;
+            }
+            shard.touched.clear();
+            for (FeatureId id : shard.touched_features) {
+                feature_weight_.col(id) +=
+                    kCrfLearningRate * shard.features.col(id);
+                shard.features.col(id).setZero();
+                shard.is_touched_feature[id] = false;
+            }
+            shard.touched_features.clear();
+            state_transition_ += kCrfLearningRate * shard.transitions;
+            shard.transitions.setZero();
+        }
+    }
+
+    int nb_correct = 0;
+    int nb_tokens = 0;
+    for (auto& shard : crf_shards_) {
+        nb_correct += shard.nb_correct;
+        nb_tokens += shard.nb_tokens;
+    }
+    SortTransitions();
+    return nb_tokens ? nb_correct * 100 / nb_tokens : 0;
+}
+
 std::string SequenceTagger::Serialize() const {
     std::ostringstream out;
+    out << kFormatMagic << " " << kFormatVersion << std::endl;
     out << input_size_ << " " << output_size_ << " " <<
         start_word_ << " " << start_label_ << " " <<
-        stop_word_ << " " << stop_label_ << std::endl;
+        stop_word_ << " " << stop_label_ << " " <<
+        feature_space_ << std::endl;
 
     for (size_t w = 0; w < input_size_; ++w) {
         for (size_t i = 0; i < output_size_; ++i) {
@@ -179,34 +617,100 @@ std::string SequenceTagger::Serialize() const {
         }
         out << std::endl;
     }
+
+    for (size_t prev = 0; prev < output_size_; ++prev) {
+        for (size_t i = 0; i < output_size_; ++i) {
+            out << state_transition_(i, prev) << " ";
+        }
+        out << std::endl;
+    }
+
+    // the hashed features that were never seen are all zeros: skip them
+    std::vector<size_t> used;
+    for (size_t f = 0; f < feature_space_; ++f) {
+        if (!feature_weight_.col(f).isZero(0)) {
+            used.push_back(f);
+        }
+    }
+    out << used.size() << std::endl;
+    for (size_t f : used) {
+        out << f << " ";
+        for (size_t i = 0; i < output_size_; ++i) {
+            out << feature_weight_(i, f) << " ";
+        }
+        out << std::endl;
+    }
     return out.str();
 }
 
 SequenceTagger SequenceTagger::FromSerialized(std::istream& in) {
-    std::string tok;
+    std::string line;
+    std::getline(in >> std::ws, line);
+    std::istringstream first(line);
+    std::string magic;
+    int version;
+    if (first >> magic && magic == kFormatMagic) {
+        first >> version;
+        LOG_IF(FATAL, !first || version > kFormatVersion)
+            << "Unsupported SequenceTagger format: " << line;
+        std::getline(in >> std::ws, line);
+    } else {
+        // the older formats only differ by the length of the header
+        std::istringstream header(line);
+        size_t nb_fields = 0;
+        for (std::string field; header >> field;) {
+            ++nb_fields;
+        }
+        version = nb_fields == 7 ? 2 : 1;
+    }
+
+    std::istringstream header(line);
     size_t in_sz = 0;
     size_t out_sz = 0;
     size_t start_word, start_label, stop_word, stop_label;
-    in >> in_sz >> out_sz >>
+    size_t feature_space = 0;
+    header >> in_sz >> out_sz >>
         start_word >> start_label >>
         stop_word >> stop_label;
+    if (version >= 2) {
+        header >> feature_space;
+    }
+    LOG_IF(FATAL, !header) << "Bad SequenceTagger header: " << line;
 
     SequenceTagger bow(in_sz, out_sz,
             start_word, start_label,
-            stop_word, stop_label);
+            stop_word, stop_label,
+            feature_space);
 
-    for (size_t i = 0; i < bow.output_size_; ++i) {
-        bow.word_weight_.emplace_back();
+    for (size_t w = 0; w < bow.input_size_; ++w) {
+        for (size_t i = 0; i < bow.output_size_; ++i) {
+            in >> bow.word_weight_(i, w);
+        }
     }
 
-    for (size_t w = 0; w < bow.input_size_; ++w) {
+    for (size_t prev = 0; prev < bow.output_size_; ++prev) {
         for (size_t i = 0; i < bow.output_size_; ++i) {
-            double score;
-            in >> score;
-            bow.word_weight_[i].push_back(score);
+            in >> bow.state_transition_(i, prev);
         }
     }
 
+    size_t nb_used = 0;
+    if (version >= 2) {
+        in >> nb_used;
+    }
+    LOG_IF(FATAL, !in) << "Truncated SequenceTagger weights";
+    for (size_t j = 0; j < nb_used; ++j) {
+        size_t f;
+        in >> f;
+        LOG_IF(FATAL, !in || f >= bow.feature_space_)
+            << "Bad SequenceTagger feature " << j << " of " << nb_used;
+        for (size_t i = 0; i < bow.output_size_; ++i) {
+            in >> bow.feature_weight_(i, f);
+        }
+    }
+    LOG_IF(FATAL, !in) << "Truncated SequenceTagger feature weights";
+
+    bow.SortTransitions();
     return bow;
 }
 
@@ -215,9 +719,8 @@ void SequenceTagger::ResizeInput(size_t in) {
         return;
     }
 
-    for (auto& weights : word_weight_) {
-        weights.resize(in);
-    }
+    word_weight_.conservativeResize(output_size_, in);
+    word_weight_.rightCols(in - input_size_).setZero();
     input_size_ = in;
 }
 
@@ -226,16 +729,16 @@ void SequenceTagger::ResizeOutput(size_t out) {
         return;
     }
 
-    word_weight_.resize(out);
-    for (size_t i = output_size_; i < out; ++i) {
-        word_weight_[i].resize(input_size_);
-    }
+    word_weight_.conservativeResize(out, input_size_);
+    word_weight_.bottomRows(out - output_size_).setZero();
 
-    state_transition_.resize(out);
-    for (size_t i = 0; i < out; ++i) {
-        state_transition_[i].resize(out);
-    }
+    state_transition_.conservativeResize(out, out);
+    state_transition_.bottomRows(out - output_size_).setZero();
+    state_transition_.rightCols(out - output_size_).setZero();
+
+    feature_weight_.conservativeResize(out, feature_space_);
+    feature_weight_.bottomRows(out - output_size_).setZero();
 
     output_size_ = out;
+    SortTransitions();
 }
-
@@ -5,12 +5,61 @@
 #include <iostream>
 
 #include <boost/bimap.hpp>
+#include <Eigen/Dense>
+#include <ad/thread_pool.h>
 
 #include "document.h"
+#include "featurizer.h"
+
+// How SequenceTagger::Compute() searches the sequences of labels. The
+// default is an exact Viterbi search, in O(words x labels^2).
+struct DecodeOptions {
+    // When non zero, only the beam_width best partial sequences are kept
+    // after each word
+    size_t beam_width = 0;
+    // When non zero, only the top_k_transitions best scoring transitions from
+    // each label are followed
+    size_t top_k_transitions = 0;
+};
 
 class SequenceTagger {
-    std::vector<std::vector<double>> word_weight_;
-    std::vector<std::vector<double>> state_transition_;
+  public:
+    // Buffers of a search, reused from one call to the next. A scratch must
+    // only be used by one thread at a time.
+    struct Scratch {
+        // FeatureTemplates ids of the sentence
+        std::vector<FeatureId> features;
+
+        // Viterbi lattice, n x labels: best score of a path ending on each
+        // label at each position, and the label before it on that path,
+        // stored as a double for ad::kernels::MaxPlus
+        std::vector<double> lattice;
+        std::vector<double> backpointers;
+        std::vector<double> emissions;
+
+        // Beam search hypotheses, beam_width per word: their label and the
+        // index of the hypothesis they extend in the previous word's beam
+        std::vector<Label> beam_labels;
+        std::vector<size_t> beam_from;
+        std::vector<size_t> beam_sizes;
+        std::vector<double> beam_scores;
+        std::vector<double> next_scores;
+        // best extension of the beam to each label, and the labels reached
+        std::vector<double> candidate_scores;
+        std::vector<size_t> candidate_from;
+        std::vector<Label> candidates;
+    };
+
+  private:
+    // labels x words: the scores of a word under every label are one
+    // contiguous column
+    Eigen::MatrixXd word_weight_;
+    // labels x labels: column prev holds the scores of the transitions from
+    // prev to every label
+    Eigen::MatrixXd state_transition_;
+    // labels x feature_space_, the weights of the hashed FeatureTemplates
+    Eigen::MatrixXd feature_weight_;
+    size_t feature_space_;
 
     size_t input_size_;
     size_t output_size_;
@@ -21,48 +70,161 @@ class SequenceTagger {
     size_t stop_word_;
     size_t stop_label_;
 
-    void Init();
-
-    double WordF(Label target, const WordFeatures& w) const;
-
-    void WordF_Backprop(
-            const WordFeatures& w, Label truth, const double* probabilities);
+    // Row prev lists the labels by decreasing score of the transition from
+    // prev, START and STOP excluded
+    std::vector<Label> successors_;
+    size_t nb_successors_;
+
+    // for Compute()
+    Scratch scratch_;
+    std::vector<Label> tags_;
+
+    // Gradient of the CRF log-likelihood of the sentences of one thread, and
+    // the buffers of their forward-backward
+    struct CrfShard {
+        // labels x words, non zero on the touched columns only
+        Eigen::MatrixXd words;
+        std::vector<size_t> touched;
+        std::vector<bool> is_touched;
+        // labels x feature space, non zero on the touched columns only
+        Eigen::MatrixXd features;
+        std::vector<FeatureId> touched_features;
+        std::vector<bool> is_touched_feature;
+        Eigen::MatrixXd transitions;
+        int nb_correct;
+        int nb_tokens;
+
+        std::vector<FeatureId> feature_ids;
+        // labels x n, scaled so that every column sums to 1
+        Eigen::MatrixXd psi;
+        Eigen::MatrixXd alpha;
+        Eigen::MatrixXd beta;
+        // exp_trans * alpha, labels x (n - 1)
+        Eigen::MatrixXd reached;
+        Eigen::MatrixXd weighted_beta;
+        Eigen::VectorXd marginal;
+        // expected counts of the transitions, labels x labels
+        Eigen::MatrixXd pair_marginals;
+    };
+    std::vector<CrfShard> crf_shards_;
 
-    double RunAllFeatures(
-            Label k, const WordFeatures& ws, const WordFeatures& prev) const;
+    void Init();
+    // Sorts successors_, after every change of the transitions
+    void SortTransitions();
+
+    void Viterbi(
+            const std::vector<WordFeatures>& ws,
+            Label* tags,
+            Scratch& scratch) const;
+    void BeamSearch(
+            const std::vector<WordFeatures>& ws,
+            Label* tags,
+            Scratch& scratch,
+            size_t beam_width,
+            size_t top_k) const;
+
+    size_t nb_features() const {
+        return feature_space_ ? FeatureTemplates::kNbTemplates : 0;
+    }
+    // Fills ids with the nb_features() features of every word of ws
+    void ExtractFeatures(
+            const std::vector<WordFeatures>& ws,
+            std::vector<FeatureId>& ids) const;
+
+    // Score of the word, with its nb_features() features, under every label
+    void WordScores(
+            size_t word, const FeatureId* features, double* scores) const;
+    // Same, -inf for START and STOP
+    void Emissions(
+            size_t word, const FeatureId* features, double* scores) const;
 
     void Backprop(
-            const WordFeatures& ws,
-            const WordFeatures& prev,
+            size_t word,
+            const FeatureId* features,
+            Label prev,
             Label truth,
             const double* probabilities);
 
+    // Adds the gradient of log p(ex.inputs' labels) to shard. exp_trans is
+    // exp(state_transition_), up to a constant factor.
+    void CrfAccumulate(
+            const TrainingExample& ex,
+            const Eigen::MatrixXd& exp_trans,
+            CrfShard& shard) const;
+
   public:
+    // Number of columns of the hashed features' weights, per label
+    static const size_t kDefaultFeatureSpace = 1 << 14;
+
+    // feature_space bounds the memory used by the hashed features, 0
+    // disables them
     SequenceTagger(
             size_t in_sz, size_t out_sz,
             size_t start_word, size_t start_label,
-            size_t stop_word, size_t stop_label);
+            size_t stop_word, size_t stop_label,
+            size_t feature_space = kDefaultFeatureSpace);
     SequenceTagger();
 
-    const std::vector<std::vector<double>>& weights() const { return word_weight_; }
-    const std::vector<double>& weights(size_t label) const { return word_weight_[label]; }
-    double weight(size_t label, size_t w) const { return word_weight_[label][w]; }
+    const Eigen::MatrixXd& weights() const { return word_weight_; }
+    Eigen::MatrixXd::ConstColXpr weights(size_t w) const {
+        return word_weight_.col(w);
+    }
+    double weight(size_t label, size_t w) const { return word_weight_(label, w); }
+    // labels x labels, column prev scores the transitions from prev
+    const Eigen::MatrixXd& transitions() const { return state_transition_; }
+    // labels x feature space, the weights of the hashed features
+    const Eigen::MatrixXd& feature_weights() const { return feature_weight_; }
 
     std::string Serialize() const;
 
+    // Also reads the unversioned files of the earlier formats
     static SequenceTagger FromSerialized(std::istream& file);
 
     double ComputeNLL(double* probas) const;
 
+    // Distribution of the label of word after the label prev. features are
+    // the FeatureTemplates of the word, or nullptr for none.
     Label ComputeTagForWord(
-            const WordFeatures& ws,
-            const WordFeatures& prev,
+            size_t word,
+            const FeatureId* features,
+            Label prev,
             double* probabilities) const;
 
-    void Compute(std::vector<WordFeatures>& ws);
-
+    // Tags ws with the best sequence of labels, from START to STOP, under the
+    // word and transition scores, as searched according to opts
+    void Compute(
+            std::vector<WordFeatures>& ws,
+            const DecodeOptions& opts = DecodeOptions());
+
+    // Same search, writing the labels of ws to tags[0 .. ws.size()). The
+    // tagger is not modified: several threads can tag with the same tagger at
+    // once, each with its own scratch.
+    void Tag(
+            const std::vector<WordFeatures>& ws,
+            Label* tags,
+            Scratch& scratch,
+            const DecodeOptions& opts = DecodeOptions()) const;
+
+    // Tags sentences[i] into tags[i], an array of sentences[i].size()
+    // labels, the sentences being split between the threads of pool
+    void TagBatch(
+            const std::vector<std::vector<WordFeatures>>& sentences,
+            const std::vector<Label*>& tags,
+            ad::ThreadPool& pool,
+            const DecodeOptions& opts = DecodeOptions()) const;
+
+    // One epoch of training of the label of each word given the previous
+    // one, as a softmax. Returns the accuracy, in percents.
     int Train(const Document& doc);
 
+    // One epoch of training of the whole sequences of labels, as a
+    // linear-chain CRF: forward-backward on each sentence, and a step of SGD
+    // per mini-batch of sentences. With a pool, the sentences of a mini-batch
+    // are split between the threads, each accumulating the gradient of its
+    // share. The result only depends on the number of threads. Returns the
+    // accuracy of the per-word most likely labels, in percents.
+    int TrainCRF(const Document& doc, ad::ThreadPool* pool = nullptr);
+
     void ResizeInput(size_t in);
     void ResizeOutput(size_t out);
 };
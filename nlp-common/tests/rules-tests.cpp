@@ -4,27 +4,98 @@
 
 #include <nlp/rules-matcher.h>
 
+static Dictionnary dict;
+
 TrainingExample Parse(const std::string& str) {
     std::istringstream input(str);
     std::string w;
     TrainingExample ex;
     input >> w;
     while (input) {
-        //ex.inputs.push_back({0, w});
+        ex.inputs.push_back(WordFeatures(w));
+        ex.inputs.back().idx = dict.FindWordId(w);
         input >> w;
     }
     return ex;
 }
 
+void Learn(const std::string& str) {
+    for (auto& w : Parse(str).inputs) {
+        dict.GetWordId(w.str);
+    }
+}
+
 int main() {
+    Learn("bonjour michel eh comment ça va ? caca a b c");
+
     RulesMatcher rm;
-    rm.AddRule("HELLO : ^ bonjour");
-    rm.AddRule("CAVA : ça va");
+    rm.AddRule("HELLO : ^ bonjour", dict);
+    rm.AddRule("CAVA : ça va", dict);
     std::cout << (rm.Match(Parse("bonjour michel")).size() == 1)    << std::endl;
     std::cout << (rm.Match(Parse("bonjour")).size() == 1)           << std::endl;
     std::cout << (rm.Match(Parse("eh bonjour")).size() == 0)        << std::endl;
     std::cout << (rm.Match(Parse("comment ça va ?")).size() == 1)   << std::endl;
     std::cout << (rm.Match(Parse("comment ça")).size() == 0)        << std::endl;
     std::cout << (rm.Match(Parse("comment ça caca va")).size() == 0) << std::endl;
+
+    // many `*` against a long input that almost matches: exponential when
+    // backtracking
+    std::string words;
+    for (int i = 0; i < 200; ++i) {
+        words += " a";
+    }
+    Rule stars("STARS : a * a * a * a * a * a * a * a * a * b");
+    std::cout << !stars.Matches(Parse(words))                       << std::endl;
+    std::cout << stars.Matches(Parse(words + " b"))                 << std::endl;
+    Rule anchored("STARS : ^ * a * a * a * a * a * a * a * a * a * c $");
+    std::cout << !anchored.Matches(Parse(words))                    << std::endl;
+    std::cout << anchored.Matches(Parse(words + " c"))              << std::endl;
+
+    RulesMatcher stars_rm;
+    stars_rm.AddRule("STARS : a * a * a * a * a * a * a * a * a * b", dict);
+    std::cout << (stars_rm.Match(Parse(words)).size() == 0)         << std::endl;
+    std::cout << (stars_rm.Match(Parse(words + " b")).size() == 1)  << std::endl;
+
+    // a word out of the vocabulary never matches, until the rules are
+    // compiled again
+    rm.AddRule("OWL : hibou", dict);
+    std::cout << (rm.Match(Parse("hibou")).size() == 0)             << std::endl;
+    std::cout << (rm.IsDead(2) && !rm.IsDead(1))                    << std::endl;
+    Learn("hibou");
+    std::cout << (rm.Match(Parse("hibou")).size() == 0)             << std::endl;
+    std::cout << !rm.IsCompiledFor(dict)                            << std::endl;
+    rm.Compile(dict);
+    std::cout << (rm.Match(Parse("hibou")).size() == 1)             << std::endl;
+    std::cout << !rm.IsDead(2)                                      << std::endl;
+    std::cout << (rm.Match(Parse("bonjour hibou")).size() == 2)     << std::endl;
+
+    // another vocabulary of the same size gives other ids
+    Dictionnary other;
+    for (auto& w : dict) {
+        if (w.second != dict.unk_id()) {
+            other.GetWordId(w.first + "!");
+        }
+    }
+    std::cout << (other.size() == dict.size())                      << std::endl;
+    std::cout << !rm.IsCompiledFor(other)                           << std::endl;
+    std::cout << rm.IsCompiledFor(Dictionnary(dict))                << std::endl;
+
+    // bulk matching gives the same rules as Match(), example by example
+    Document doc;
+    for (auto& str : {"bonjour hibou", "hibou ça va", "rien", "bonjour"}) {
+        doc.examples.push_back(Parse(str));
+    }
+    ad::ThreadPool pool(1);
+    RulesMatcher::Matches matches = rm.MatchAll(doc, pool);
+    bool same = matches.offsets.size() == doc.examples.size() + 1;
+    for (size_t i = 0; same && i < doc.examples.size(); ++i) {
+        std::vector<std::string> keys;
+        for (size_t m = matches.offsets[i]; m < matches.offsets[i + 1]; ++m) {
+            keys.push_back(rm.rule(matches.rules[m]).key());
+        }
+        same = keys == rm.Match(doc.examples[i]);
+    }
+    std::cout << same                                               << std::endl;
+    std::cout << (matches.coverage == std::vector<size_t>{2, 1, 2}) << std::endl;
     return 0;
 }
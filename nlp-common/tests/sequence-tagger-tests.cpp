@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlp/sequence-tagger.h>
+
+// Label 0 is START and label 1 is STOP, word 0 is START and word 1 is STOP
+static const size_t kStart = 0;
+static const size_t kStop = 1;
+static const size_t kUnknown = static_cast<unsigned int>(-1);
+static const size_t kNbWords = 6;
+static const size_t kFeatureSpace = 8;
+
+static std::mt19937 rng(42);
+
+// The weights of a tagger, laid out like SequenceTagger's
+struct Weights {
+    Eigen::MatrixXd words;
+    Eigen::MatrixXd transitions;
+    Eigen::MatrixXd features;
+};
+
+static Weights RandomWeights(size_t nb_labels) {
+    std::uniform_real_distribution<double> coef(-2, 2);
+    auto random = [&](size_t rows, size_t cols) {
+        Eigen::MatrixXd m(rows, cols);
+        for (int i = 0; i < m.size(); ++i) {
+            m(i) = coef(rng);
+        }
+        return m;
+    };
+    return Weights{random(nb_labels, kNbWords),
+        random(nb_labels, nb_labels),
+        random(nb_labels, kFeatureSpace)};
+}
+
+// w in the serialized format of the given version. Version 1 has no hashed
+// features and versions 1 and 2 have no magic line.
+static std::string Serialized(const Weights& w, int version) {
+    const size_t nb_labels = w.transitions.rows();
+    std::ostringstream out;
+    out << std::setprecision(17);
+    if (version >= 3) {
+        out << "sequence-tagger " << version << "\n";
+    }
+    out << kNbWords << " " << nb_labels << " " << kStart << " " << kStart
+        << " " << kStop << " " << kStop;
+    if (version >= 2) {
+        out << " " << kFeatureSpace;
+    }
+    out << "\n";
+    for (size_t word = 0; word < kNbWords; ++word) {
+        for (size_t i = 0; i < nb_labels; ++i) {
+            out << w.words(i, word) << " ";
+        }
+        out << "\n";
+    }
+    for (size_t prev = 0; prev < nb_labels; ++prev) {
+        for (size_t i = 0; i < nb_labels; ++i) {
+            out << w.transitions(i, prev) << " ";
+        }
+        out << "\n";
+    }
+    if (version >= 2) {
+        out << kFeatureSpace << "\n";
+        for (size_t f = 0; f < kFeatureSpace; ++f) {
+            out << f << " ";
+            for (size_t i = 0; i < nb_labels; ++i) {
+                out << w.features(i, f) << " ";
+            }
+            out << "\n";
+        }
+    }
+    return out.str();
+}
+
+static SequenceTagger Load(const std::string& serialized) {
+    std::istringstream in(serialized);
+    return SequenceTagger::FromSerialized(in);
+}
+
+// A tagger holding exactly w
+static SequenceTagger MakeTagger(const Weights& w) {
+    return Load(Serialized(w, 3));
+}
+
+static std::vector<WordFeatures> RandomSentence(size_t nb_labels) {
+    std::uniform_int_distribution<size_t> length(1, 5);
+    std::uniform_int_distribution<size_t> word(2, kNbWords);
+    std::uniform_int_distribution<size_t> label(2, nb_labels - 1);
+    std::vector<WordFeatures> ws;
+    for (size_t i = length(rng); i > 0; --i) {
+        size_t idx = word(rng);
+        // one word past the vocabulary is unknown
+        WordFeatures wf(std::string(1, 'a' + idx) + "x");
+        wf.idx = idx < kNbWords ? idx : kUnknown;
+        wf.pos = label(rng);
+        ws.push_back(wf);
+    }
+    return ws;
+}
+
+// Scores of every label for every word of ws, labels x words, -inf for
+// START and STOP
+static Eigen::MatrixXd Emissions(
+        const Weights& w, const std::vector<WordFeatures>& ws) {
+    const size_t nb = FeatureTemplates::kNbTemplates;
+    std::vector<FeatureId> ids(ws.size() * nb);
+    FeatureTemplates::Extract(ws, kFeatureSpace, ids.data());
+
+    Eigen::MatrixXd em = Eigen::MatrixXd::Zero(w.words.rows(), ws.size());
+    for (size_t t = 0; t < ws.size(); ++t) {
+        if (ws[t].idx != kUnknown) {
+            em.col(t) += w.words.col(ws[t].idx);
+        }
+        for (size_t f = 0; f < nb; ++f) {
+            em.col(t) += w.features.col(ids[t * nb + f]);
+        }
+        em(kStart, t) = -std::numeric_limits<double>::infinity();
+        em(kStop, t) = -std::numeric_limits<double>::infinity();
+    }
+    return em;
+}
+
+// Score of the labels tags for ws, from START to STOP
+static double Score(const Weights& w,
+                    const Eigen::MatrixXd& em,
+                    const std::vector<Label>& tags) {
+    double s = w.transitions(tags[0], kStart) + w.transitions(kStop, tags.back());
+    for (size_t t = 0; t < tags.size(); ++t) {
+        s += em(tags[t], t);
+        if (t > 0) {
+            s += w.transitions(tags[t], tags[t - 1]);
+        }
+    }
+    return s;
+}
+
+// Calls f on every sequence of labels of the length of em, START and STOP
+// excluded
+template <class F>
+static void ForEachSequence(const Eigen::MatrixXd& em, F f) {
+    const size_t nb_labels = em.rows();
+    std::vector<Label> tags(em.cols(), 2);
+    while (true) {
+        f(tags);
+        size_t t = 0;
+        while (t < tags.size() && ++tags[t] == nb_labels) {
+            tags[t] = 2;
+            ++t;
+        }
+        if (t == tags.size()) {
+            return;
+        }
+    }
+}
+
+static std::vector<Label> BruteForce(
+        const Weights& w, const std::vector<WordFeatures>& ws) {
+    Eigen::MatrixXd em = Emissions(w, ws);
+    std::vector<Label> best;
+    double best_score = -std::numeric_limits<double>::infinity();
+    ForEachSequence(em, [&](const std::vector<Label>& tags) {
+        double s = Score(w, em, tags);
+        if (s > best_score) {
+            best_score = s;
+            best = tags;
+        }
+    });
+    return best;
+}
+
+// The best label of each word given the label chosen for the previous one
+static std::vector<Label> Greedy(
+        const Weights& w, const std::vector<WordFeatures>& ws) {
+    Eigen::MatrixXd em = Emissions(w, ws);
+    std::vector<Label> tags;
+    Label prev = kStart;
+    for (size_t t = 0; t < ws.size(); ++t) {
+        Eigen::VectorXd scores = em.col(t) + w.transitions.col(prev);
+        Eigen::VectorXd::Index best;
+        scores.maxCoeff(&best);
+        tags.push_back(best);
+        prev = best;
+    }
+    return tags;
+}
+
+// log p(labels of ws | ws) under the linear-chain CRF of w
+static double LogLikelihood(
+        const Weights& w, const std::vector<WordFeatures>& ws) {
+    Eigen::MatrixXd em = Emissions(w, ws);
+    std::vector<double> scores;
+    ForEachSequence(em, [&](const std::vector<Label>& tags) {
+        scores.push_back(Score(w, em, tags));
+    });
+    double max = *std::max_element(scores.begin(), scores.end());
+    double total = 0;
+    for (double s : scores) {
+        total += std::exp(s - max);
+    }
+    std::vector<Label> gold;
+    for (auto& wf : ws) {
+        gold.push_back(wf.pos);
+    }
+    return Score(w, em, gold) - max - std::log(total);
+}
+
+// Largest difference between the step TrainCRF() takes on a single sentence
+// and the finite-difference gradient of its log-likelihood
+static double CrfGradientError(size_t nb_labels) {
+    const double kEpsilon = 1e-5;
+    // the learning rate of TrainCRF()
+    const double kStep = 0.05;
+
+    Weights w = RandomWeights(nb_labels);
+    Document doc;
+    doc.examples.push_back(TrainingExample{RandomSentence(nb_labels), 0});
+    SequenceTagger tagger = MakeTagger(w);
+    tagger.TrainCRF(doc);
+
+    double error = 0;
+    auto check = [&](Eigen::MatrixXd& param, const Eigen::MatrixXd& trained) {
+        for (int i = 0; i < param.size(); ++i) {
+            double orig = param(i);
+            param(i) = orig + kEpsilon;
+            double plus = LogLikelihood(w, doc.examples[0].inputs);
+            param(i) = orig - kEpsilon;
+            double minus = LogLikelihood(w, doc.examples[0].inputs);
+            param(i) = orig;
+
+            double numeric = (plus - minus) / (2 * kEpsilon);
+            double analytic = (trained(i) - orig) / kStep;
+            error = std::max(error, std::abs(numeric - analytic));
+        }
+    };
+    check(w.words, tagger.weights());
+    check(w.transitions, tagger.transitions());
+    check(w.features, tagger.feature_weights());
+    return error;
+}
+
+static std::vector<Label> Tags(const std::vector<WordFeatures>& ws) {
+    std::vector<Label> tags;
+    for (auto& wf : ws) {
+        tags.push_back(wf.pos);
+    }
+    return tags;
+}
+
+// The FeatureTemplates of a single word, in a space big enough to make
+// collisions unlikely
+static std::vector<FeatureId> Features(const std::string& word) {
+    std::vector<FeatureId> ids(FeatureTemplates::kNbTemplates);
+    FeatureTemplates::Extract({WordFeatures(word)}, 1 << 30, ids.data());
+    return ids;
+}
+
+int main() {
+    // Viterbi finds the best sequence, a beam of width 1 the greedy one
+    bool viterbi = true;
+    bool beam = true;
+    for (int i = 0; i < 300; ++i) {
+        size_t nb_labels = 3 + i % 4;
+        Weights w = RandomWeights(nb_labels);
+        SequenceTagger tagger = MakeTagger(w);
+        std::vector<WordFeatures> ws = RandomSentence(nb_labels);
+
+        tagger.Compute(ws);
+        viterbi = viterbi && Tags(ws) == BruteForce(w, ws);
+
+        DecodeOptions opts;
+        opts.beam_width = 1;
+        tagger.Compute(ws, opts);
+        beam = beam && Tags(ws) == Greedy(w, ws);
+    }
+    std::cout << viterbi                                            << std::endl;
+    std::cout << beam                                               << std::endl;
+
+    // the CRF follows the gradient of the log-likelihood
+    double crf_error = 0;
+    for (int i = 0; i < 50; ++i) {
+        crf_error = std::max(crf_error, CrfGradientError(3 + i % 3));
+    }
+    std::cout << (crf_error < 1e-6)                                 << std::endl;
+
+    // training over a pool gives the same weights as on a single thread,
+    // up to the order of the floating point sums
+    Document doc;
+    for (int i = 0; i < 100; ++i) {
+        doc.examples.push_back(TrainingExample{RandomSentence(6), 0});
+    }
+    Weights init = RandomWeights(6);
+    SequenceTagger single = MakeTagger(init);
+    SequenceTagger pooled = MakeTagger(init);
+    ad::ThreadPool pool(2);
+    bool same_accuracy = true;
+    for (int epoch = 0; epoch < 3; ++epoch) {
+        same_accuracy = same_accuracy
+            && single.TrainCRF(doc) == pooled.TrainCRF(doc, &pool);
+    }
+    std::cout << same_accuracy                                      << std::endl;
+    std::cout << (single.weights().isApprox(pooled.weights(), 1e-12)
+            && single.transitions().isApprox(pooled.transitions(), 1e-12)
+            && single.feature_weights().isApprox(
+                pooled.feature_weights(), 1e-12))                   << std::endl;
+
+    // batch tagging over a pool gives the tags of Compute()
+    std::vector<std::vector<WordFeatures>> sentences;
+    for (int i = 0; i < 200; ++i) {
+        sentences.push_back(RandomSentence(6));
+    }
+    DecodeOptions beam_opts;
+    beam_opts.beam_width = 2;
+    beam_opts.top_k_transitions = 3;
+    for (const DecodeOptions& opts : {DecodeOptions(), beam_opts}) {
+        std::vector<std::vector<Label>> batch_tags;
+        std::vector<Label*> outputs;
+        for (auto& ws : sentences) {
+            batch_tags.emplace_back(ws.size());
+            outputs.push_back(batch_tags.back().data());
+        }
+        pooled.TagBatch(sentences, outputs, pool, opts);
+
+        bool same = true;
+        for (size_t i = 0; i < sentences.size(); ++i) {
+            std::vector<WordFeatures> ws = sentences[i];
+            pooled.Compute(ws, opts);
+            same = same && Tags(ws) == batch_tags[i];
+        }
+        std::cout << same                                           << std::endl;
+    }
+
+    // affixes are cut on UTF-8 code points, Latin-1 letters are lowercased
+    std::cout << (Features("éèxa")[FeatureTemplates::kPrefix]
+                == Features("éèxb")[FeatureTemplates::kPrefix]
+            && Features("ééx")[FeatureTemplates::kPrefix]
+                != Features("éèx")[FeatureTemplates::kPrefix]
+            && Features("aéè")[FeatureTemplates::kSuffix]
+                == Features("baéè")[FeatureTemplates::kSuffix]) << std::endl;
+    std::cout << (Features("École")[FeatureTemplates::kLowercase]
+                == Features("école")[FeatureTemplates::kLowercase]
+            && Features("ÉCOLE")[FeatureTemplates::kShape]
+                == Features("ECOLE")[FeatureTemplates::kShape]
+            && Features("École")[FeatureTemplates::kShape]
+                == Features("Ecole")[FeatureTemplates::kShape]) << std::endl;
+
+    // a serialized tagger tags the same and serializes the same
+    Weights w = RandomWeights(5);
+    SequenceTagger tagger = MakeTagger(w);
+    SequenceTagger loaded = Load(tagger.Serialize());
+    std::cout << (tagger.Serialize().find("sequence-tagger 3\n") == 0) << std::endl;
+    std::cout << (loaded.Serialize() == tagger.Serialize())         << std::endl;
+    std::cout << loaded.weights().isApprox(w.words, 1e-5)           << std::endl;
+    bool same_tags = true;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<WordFeatures> ws = RandomSentence(5);
+        std::vector<WordFeatures> loaded_ws = ws;
+        tagger.Compute(ws);
+        loaded.Compute(loaded_ws);
+        same_tags = same_tags && Tags(ws) == Tags(loaded_ws);
+    }
+    std::cout << same_tags                                          << std::endl;
+
+    // the unversioned formats are still read
+    SequenceTagger v2 = Load(Serialized(w, 2));
+    std::cout << (v2.Serialize() == tagger.Serialize())             << std::endl;
+    SequenceTagger v1 = Load(Serialized(w, 1));
+    std::cout << (v1.weights() == w.words
+            && v1.transitions() == w.transitions
+            && v1.feature_weights().size() == 0)                    << std::endl;
+    return 0;
+}
@@ -1,17 +1,40 @@
 #include <glog/logging.h>
+#include <chrono>
 #include <fstream>
 
 #include <nlp/tokenizer.h>
 
 #include "bow.h"
 
+void BoWClassifier::CompileRules() {
+    std::shared_ptr<const CompiledRules> rules = std::atomic_load(&rules_);
+    if (rules->matcher.IsCompiledFor(ngram_.dict())) {
+        return;
+    }
+    auto compiled = std::make_shared<CompiledRules>(*rules);
+    compiled->matcher.Compile(ngram_.dict());
+    std::atomic_store(&rules_,
+                      std::shared_ptr<const CompiledRules>(std::move(compiled)));
+}
+
 size_t BoWClassifier::Train(const Document& doc) {
     bow_.ResizeInput(ngram_.dict().size());
     bow_.ResizeOutput(ls_.size());
+    CompileRules();
 
     return bow_.Train(doc);
 }
 
+void BoWClassifier::Learn(const Document& doc) {
+    bow_.ResizeInput(ngram_.dict().size());
+    bow_.ResizeOutput(ls_.size());
+    CompileRules();
+
+    for (auto& ex : doc.examples) {
+        bow_.Learn(ex);
+    }
+}
+
 Document BoWClassifier::Parse(const std::string& str) {
     std::istringstream dataset(str);
     std::string line;
@@ -28,17 +51,65 @@ Document BoWClassifier::Parse(const std::string& str) {
         ngram_.Learn(toks);
         doc.examples.push_back(TrainingExample{toks, ls_.GetLabel(label)});
     }
+    // words and labels were learnt: the model and the rules follow, so that
+    // training does not resize what the other threads read
+    bow_.ResizeInput(ngram_.dict().size());
+    bow_.ResizeOutput(ls_.size());
+    CompileRules();
     return doc;
 }
 
 BowResult BoWClassifier::ComputeClass(const std::string& data) {
-    auto toks = Tokenizer::FR(data);
-    ngram_.Annotate(toks);
+    TrainingExample ex{Tokenizer::FR(data), 0};
+    ngram_.Lookup(ex.inputs);
 
-    Eigen::MatrixXd probas = bow_.ComputeClass(toks);
+    std::shared_ptr<const CompiledRules> rules = std::atomic_load(&rules_);
+    if (rules->matcher.size() != 0) {
+        // one per request handling thread
+        static thread_local RulesMatcher::Scratch scratch;
+        auto start = std::chrono::steady_clock::now();
+        const auto& matched = rules->matcher.Match(ex, scratch);
+
+        if (!matched.empty()) {
+            Label label = rules->labels[matched[0]];
+            Eigen::MatrixXd confidence = Eigen::MatrixXd::Zero(ls_.size(), 1);
+            confidence(label, 0) = 1;
+            rules_stats_.Add(true, std::chrono::steady_clock::now() - start);
+            return {confidence, label, std::move(ex.inputs), int(matched[0]),
+                    std::move(rules)};
+        }
+        rules_stats_.Add(false, std::chrono::steady_clock::now() - start);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Eigen::MatrixXd probas = bow_.ComputeClass(ex.inputs);
     Eigen::MatrixXd::Index label_res, dummy_zero;
     probas.maxCoeff(&label_res, &dummy_zero);
-    return {probas, label_res, toks};
+    model_stats_.Add(true, std::chrono::steady_clock::now() - start);
+    return {probas, Label(label_res), std::move(ex.inputs)};
+}
+
+RulesReport BoWClassifier::LoadRules(const std::string& str) {
+    std::istringstream in(str);
+    std::string line;
+    auto rules = std::make_shared<CompiledRules>();
+    while (std::getline(in, line)) {
+        std::istringstream rule(line);
+        std::string label, colon;
+        rule >> label >> colon;
+        if (colon != ":" || !ls_.HasLabel(label)) {
+            continue;
+        }
+        rules->matcher.AddRule(line, ngram_.dict());
+        rules->labels.push_back(ls_.GetLabel(label));
+    }
+
+    RulesReport report;
+    report.nb_loaded = rules->matcher.size();
+    report.nb_dead = rules->nb_dead();
+    std::atomic_store(&rules_,
+                      std::shared_ptr<const CompiledRules>(std::move(rules)));
+    return report;
 }
 
 BoWClassifier BoWClassifier::FromSerialized(std::istream& in) {
@@ -46,5 +117,6 @@ BoWClassifier BoWClassifier::FromSerialized(std::istream& in) {
     bow.ngram_ = NGramMaker::FromSerialized(in);
     bow.bow_ = BagOfWords::FromSerialized(in);
     bow.ls_ = LabelSet::FromSerialized(in);
+    bow.CompileRules();
     return bow;
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -7,20 +11,101 @@
 #include <nlp/bow.h>
 #include <nlp/dict.h>
 #include <nlp/document.h>
+#include <nlp/rules-matcher.h>
 
 #include <Eigen/Dense>
 
+// The rules of BoWClassifier::ComputeClass(), compiled for a vocabulary.
+// Never modified once published: loading or compiling the rules again
+// builds a new one.
+struct CompiledRules {
+    RulesMatcher matcher;
+    // label of each rule
+    std::vector<Label> labels;
+
+    // Rules with a word out of the vocabulary, which never match
+    size_t nb_dead() const {
+        size_t nb = 0;
+        for (size_t i = 0; i < matcher.size(); ++i) {
+            nb += matcher.IsDead(i) ? 1 : 0;
+        }
+        return nb;
+    }
+};
+
 struct BowResult {
     Eigen::MatrixXd confidence;
     Label label;
     std::vector<WordFeatures> words;
+    // index of the rule that gave the label, -1 if the model did
+    int rule = -1;
+    // the rules rule is from
+    std::shared_ptr<const CompiledRules> rules;
+};
+
+// Requests reaching a stage of BoWClassifier::ComputeClass(), those it
+// answered, and the time spent in it. Updated by concurrent requests.
+struct StageStats {
+    std::atomic<size_t> nb_requests{0};
+    std::atomic<size_t> nb_hits{0};
+    // std::atomic<double> has no fetch_add
+    std::atomic<uint64_t> nanoseconds{0};
+
+    StageStats() = default;
+    StageStats(const StageStats& other) { *this = other; }
+    StageStats& operator=(const StageStats& other) {
+        nb_requests = other.nb_requests.load();
+        nb_hits = other.nb_hits.load();
+        nanoseconds = other.nanoseconds.load();
+        return *this;
+    }
+
+    void Add(bool hit, std::chrono::steady_clock::duration time) {
+        ++nb_requests;
+        nb_hits += hit ? 1 : 0;
+        nanoseconds +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    }
+
+    double hit_ratio() const {
+        size_t nb = nb_requests;
+        return nb ? double(nb_hits) / nb : 0;
+    }
+    double mean_seconds() const {
+        size_t nb = nb_requests;
+        return nb ? nanoseconds * 1e-9 / nb : 0;
+    }
+};
+
+// Rules kept by BoWClassifier::LoadRules()
+struct RulesReport {
+    size_t nb_loaded = 0;
+    // those with a word the model never saw, which never match until the
+    // word is learnt
+    size_t nb_dead = 0;
 };
 
 class BoWClassifier {
   public:
     size_t Train(const Document& doc);
+    // Online learning: applies each example of doc once
+    void Learn(const Document& doc);
+    void SetProfiler(ad::Profiler* profiler) { bow_.SetProfiler(profiler); }
+    // The label of the first rule matching ws if any, without running the
+    // model, the prediction of the model otherwise
     BowResult ComputeClass(const std::string& ws);
 
+    // Replaces the rules of ComputeClass() by those of str, one
+    // "LABEL : pattern" per line, by decreasing priority. Lines with a bad
+    // syntax or a label unknown to the model are ignored.
+    RulesReport LoadRules(const std::string& str);
+    // The rules ComputeClass() currently uses
+    std::shared_ptr<const CompiledRules> rules() const {
+        return std::atomic_load(&rules_);
+    }
+    const StageStats& rules_stats() const { return rules_stats_; }
+    const StageStats& model_stats() const { return model_stats_; }
+
     Document Parse(const std::string& str);
 
     LabelSet& labels() { return ls_; }
@@ -39,11 +124,20 @@ class BoWClassifier {
         return ngram_.Serialize() + bow_.Serialize() + ls_.Serialize();
     }
 
-    BoWClassifier() : bow_(0, 0) {}
+    BoWClassifier()
+        : bow_(0, 0), rules_(std::make_shared<const CompiledRules>()) {}
 
   private:
     NGramMaker ngram_;
     BagOfWords bow_;
     LabelSet ls_;
+
+    // Replaced with std::atomic_store whenever the rules or the vocabulary
+    // change, never by ComputeClass(), which loads it once per request
+    std::shared_ptr<const CompiledRules> rules_;
+    StageStats rules_stats_;
+    StageStats model_stats_;
+
+    void CompileRules();
 };
 
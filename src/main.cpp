@@ -4,6 +4,8 @@
 #include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -22,28 +24,62 @@
 
 namespace htmli = httpi::html;
 
+// Requests reading the model hold it shared and run concurrently. Those
+// changing the vocabulary, the labels, the rules or the whole model hold it
+// exclusively.
+typedef std::shared_timed_mutex ModelMutex;
+
 class TrainJob : public WebJob {
     BoWClassifier& bow_;
+    ModelMutex& model_mutex_;
     size_t nb_epoch_;
     const Document& trainingset_;
     bool stopped_;
+    ad::Profiler profiler_;
 
    public:
-    TrainJob(BoWClassifier& bow, const Document& ts, size_t nb_epoch)
-        : bow_(bow), nb_epoch_(nb_epoch), trainingset_(ts), stopped_(false) {}
+    TrainJob(BoWClassifier& bow,
+             ModelMutex& model_mutex,
+             const Document& ts,
+             size_t nb_epoch)
+        : bow_(bow),
+          model_mutex_(model_mutex),
+          nb_epoch_(nb_epoch),
+          trainingset_(ts),
+          stopped_(false) {}
 
     void Do() {
         htmli::Chart accuracy_chart("accuracy");
         accuracy_chart.Label("iter").Value("accuracy");
 
+        // one training at a time
+        static std::mutex training;
         for (size_t epoch = 0; epoch < nb_epoch_ && !stopped_; ++epoch) {
-            int accuracy = bow_.Train(trainingset_);
+            int accuracy;
+            {
+                // predictions go on while training, changes of the model
+                // wait for the end of the epoch
+                std::shared_lock<ModelMutex> model(model_mutex_);
+                std::lock_guard<std::mutex> lock(training);
+                bow_.SetProfiler(&profiler_);
+                accuracy = bow_.Train(trainingset_);
+                bow_.SetProfiler(nullptr);
+            }
 
             accuracy_chart.Log("accuracy", accuracy);
             accuracy_chart.Log("iter", epoch);
-            SetPage(htmli::Html() << accuracy_chart.Get());
+            SetPage(htmli::Html() << accuracy_chart.Get() << Profile());
         }
     }
+
+    // Time spent in every operator of the model so far
+    htmli::Html Profile() const {
+        using namespace htmli;
+        return Html() << H3() << "Profile" << Close()
+                      << Tag("pre") << profiler_.Table() << Close()
+                      << Tag("details") << Tag("summary") << "JSON" << Close()
+                      << Tag("pre") << profiler_.Json() << Close() << Close();
+    }
     virtual std::string name() const { return "Train"; }
 
     virtual void Stop() { stopped_ = true; }
@@ -52,16 +88,10 @@ class TrainJob : public WebJob {
 void AddExample(BoWClassifier& bow,
                 Document& ts,
                 const std::string& example,
-                const std::string& label,
-                size_t nb_epoch) {
-    Document minibatch = bow.Parse(example + " | " + label);
-    ts.examples.push_back(minibatch.examples[0]);
-    std::copy_n(ts.examples.rbegin(),
-                std::min(ts.examples.size(), 9ul),
-                std::back_inserter(minibatch.examples));
-    for (size_t epoch = 0; epoch < nb_epoch; ++epoch) {
-        bow.Train(minibatch);
-    }
+                const std::string& label) {
+    Document added = bow.Parse(example + " | " + label);
+    ts.examples.push_back(added.examples[0]);
+    bow.Learn(added);
 }
 
 BoWClassifier Load(const std::string& input_str) {
@@ -119,6 +149,9 @@ int main() {
 
     BoWClassifier bow;
     Document trainingset;
+    ModelMutex model_mutex;
+    typedef std::shared_lock<ModelMutex> Reading;
+    typedef std::unique_lock<ModelMutex> Writing;
 
     server.RegisterUrl(
         "/", [&monitoring_job](const std::string&, const POSTValues&) {
@@ -137,16 +170,22 @@ int main() {
                         "Classify",
                         "Classify the input text to one of the categories",
                         {{"input", "text", "Text to classify"}}},
-                    [&bow](const std::string& input) {
+                    [&bow, &model_mutex](const std::string& input) {
+                        Reading lock(model_mutex);
                         return bow.ComputeClass(input);
                     },
-                    [&bow](const BowResult& res) {
+                    [&bow, &model_mutex](const BowResult& res) {
+                        Reading lock(model_mutex);
                         return ClassifyResult(bow, res);
                     },
-                    [&bow](const BowResult& res) {
+                    [&bow, &model_mutex](const BowResult& res) {
+                        Reading lock(model_mutex);
                         return JsonBuilder()
                             .Append("confidence", res.confidence(res.label, 0))
                             .Append("label", bow.labels().GetString(res.label))
+                            .Append("stage", std::string(res.rule == -1
+                                                             ? "model"
+                                                             : "rules"))
                             .Build();
                     })));
 
@@ -162,10 +201,13 @@ int main() {
                         "Load",
                         "Load a model",
                         {{"model", "file", "The model file"}}},
-                    [&bow](const std::string& model) {
+                    [&bow, &model_mutex](const std::string& model) {
+                        Writing lock(model_mutex);
                         htmli::Html html;
                         html << Save(bow);
+                        std::string rules = bow.rules()->matcher.Serialize();
                         bow = Load(model);
+                        bow.LoadRules(rules);
                         return 0;
                     },
                     [](int) { return htmli::Html() << "Model loaded"; },
@@ -177,7 +219,10 @@ int main() {
                 httpi::RestResource(
                     htmli::FormDescriptor<>{},
                     []() { return 0; },
-                    [&bow](int) { return Save(bow) << DisplayWeights(bow); },
+                    [&bow, &model_mutex](int) {
+                        Reading lock(model_mutex);
+                        return Save(bow) << DisplayWeights(bow);
+                    },
                     [](int) {
                         // FIXME: not implemented. The model is serialized with
                         // newlines and multilines strings are forbidden in
@@ -185,27 +230,92 @@ int main() {
                         return JsonBuilder().Append("result", 1).Build();
                     })));
 
+    server.RegisterUrl(
+        "/rules",
+        httpi::RestPageMaker(PageGlobal)
+            .AddResource(
+                "POST",
+                httpi::RestResource(
+                    htmli::FormDescriptor<std::string>{
+                        "POST",
+                        "/rules",
+                        "Upload rules",
+                        "Rules answering before the model, one "
+                        "\"LABEL : pattern\" per line, by decreasing "
+                        "priority",
+                        {{"rules", "file", "The rules file"}}},
+                    [&bow, &model_mutex](const std::string& rules) {
+                        Writing lock(model_mutex);
+                        return bow.LoadRules(rules);
+                    },
+                    [](const RulesReport& report) {
+                        htmli::Html html;
+                        html << std::to_string(report.nb_loaded)
+                             << " rules loaded";
+                        if (report.nb_dead) {
+                            html << ", " << std::to_string(report.nb_dead)
+                                 << " of them with words unknown to the model:"
+                                    " they never match until those words are"
+                                    " learnt";
+                        }
+                        return html;
+                    },
+                    [](const RulesReport& report) {
+                        return JsonBuilder()
+                            .Append("rules", int(report.nb_loaded))
+                            .Append("dead_rules", int(report.nb_dead))
+                            .Build();
+                    }))
+            .AddResource(
+                "GET",
+                httpi::RestResource(
+                    htmli::FormDescriptor<>{},
+                    []() { return 0; },
+                    [&bow, &model_mutex](int) {
+                        Reading lock(model_mutex);
+                        return DisplayRules(bow);
+                    },
+                    [&bow, &model_mutex](int) {
+                        Reading lock(model_mutex);
+                        auto stage = [](const StageStats& stats) {
+                            return JsonBuilder()
+                                .Append("requests", int(stats.nb_requests))
+                                .Append("hit_ratio", stats.hit_ratio())
+                                .Append("mean_latency", stats.mean_seconds());
+                        };
+                        const StageStats& rules = bow.rules_stats();
+                        const StageStats& model = bow.model_stats();
+                        auto compiled = bow.rules();
+                        return JsonBuilder()
+                            .Append("rules", int(compiled->matcher.size()))
+                            .Append("dead_rules", int(compiled->nb_dead()))
+                            .Append("rules_stage", stage(rules))
+                            .Append("model_stage", stage(model))
+                            .Append("time_saved",
+                                    rules.nb_hits * model.mean_seconds())
+                            .Build();
+                    })));
+
     server.RegisterUrl(
         "/dataset",
         httpi::RestPageMaker(PageGlobal)
             .AddResource(
                 "PUT",
                 httpi::RestResource(
-                    htmli::FormDescriptor<std::string, std::string, int>{
+                    htmli::FormDescriptor<std::string, std::string>{
                         "PUT",
                         "/dataset",
                         "Single example",
                         "Add a single training example",
                         {{"input", "text", "An input sentence"},
-                         {"label", "text", "The label"},
-                         {"epoch", "number", "How many iterations?"}}},
-                    [&jp, &bow, &trainingset](const std::string& input,
-                                              const std::string& label,
-                                              int epoch) {
-                        AddExample(bow, trainingset, input, label, epoch);
+                         {"label", "text", "The label"}}},
+                    [&bow, &trainingset, &model_mutex](
+                        const std::string& input, const std::string& label) {
+                        Writing lock(model_mutex);
+                        AddExample(bow, trainingset, input, label);
                         return 0;
                     },
-                    [](int) { return htmli::Html() << "Learning started"; },
+                    [](int) { return htmli::Html() << "Example learnt"; },
                     [](int) {
                         return JsonBuilder().Append("result", 0).Build();
                     }))
@@ -219,11 +329,12 @@ int main() {
                         "Uploads a new dataset",
                         {{"trainingset", "file", "A training set"},
                          {"epoch", "number", "Number of training epochs"}}},
-                    [&jp, &bow, &trainingset](
+                    [&jp, &bow, &trainingset, &model_mutex](
                         const std::string& str_trainingset, int epoch) {
+                        Writing lock(model_mutex);
                         trainingset = bow.Parse(str_trainingset);
                         return jp.StartJob(std::make_unique<TrainJob>(
-                            bow, trainingset, epoch));
+                            bow, model_mutex, trainingset, epoch));
                     },
                     [](int id) {
                         using namespace htmli;
@@ -238,7 +349,9 @@ int main() {
             .AddResource("GET",
                          httpi::RestResource(htmli::FormDescriptor<>{},
                                              []() { return 0; },
-                                             [&bow, &trainingset](int) {
+                                             [&bow, &trainingset,
+                                              &model_mutex](int) {
+                                                 Reading lock(model_mutex);
                                                  return SaveDataset(
                                                      bow, trainingset);
                                              },
@@ -22,6 +22,11 @@ httpi::html::Html ClassifyResult(BoWClassifier& bow, const BowResult& bowr) {
             html << Tag("span") << "_UNK_ " << Close();
         }
     }
+    if (bowr.rule != -1) {
+        const Rule& rule = bowr.rules->matcher.rule(bowr.rule);
+        html << P() << "matched rule: " << rule.key() << " : "
+            << rule.AsString() << Close();
+    }
     html <<
         P() << "best prediction: " << bow.labels().GetString(k) <<
         " " << std::to_string(probas(k, 0) * 100)
@@ -43,6 +43,11 @@ std::string PageGlobal(const std::string& content) {
                                     "Model" <<
                                 Close() <<
                             Close() <<
+                            Li() <<
+                                A().Attr("href", "/rules") <<
+                                    "Rules" <<
+                                Close() <<
+                            Close() <<
                         Close() <<
                     "</div>"
                 "</div>"
@@ -10,3 +10,4 @@
 std::string PageGlobal(const std::string& content);
 httpi::html::Html ClassifyResult(BoWClassifier& bow, const BowResult& bowr);
 httpi::html::Html DisplayWeights(BoWClassifier& bow);
+httpi::html::Html DisplayRules(BoWClassifier& bow);
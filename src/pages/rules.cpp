@@ -0,0 +1,66 @@
+#include "pages.h"
+
+static httpi::html::Html StageRow(const std::string& name,
+                                  const StageStats& stats) {
+    using namespace httpi::html;
+    return Html() <<
+        Tag("tr") <<
+            Tag("td") << name << Close() <<
+            Tag("td") << std::to_string(stats.nb_requests) << Close() <<
+            Tag("td") << std::to_string(stats.hit_ratio() * 100) << Close() <<
+            Tag("td") << std::to_string(stats.mean_seconds() * 1e6) << Close() <<
+        Close();
+}
+
+httpi::html::Html DisplayRules(BoWClassifier& bow) {
+    using namespace httpi::html;
+
+    const StageStats& rules = bow.rules_stats();
+    const StageStats& model = bow.model_stats();
+    // the rules may be replaced while the page is built
+    std::shared_ptr<const CompiledRules> compiled = bow.rules();
+    const RulesMatcher& matcher = compiled->matcher;
+
+    Html html;
+    html <<
+    H2() << "Stages" << Close() <<
+    Tag("table").AddClass("table") <<
+        Tag("tr") <<
+            Tag("th") << "Stage" << Close() <<
+            Tag("th") << "Requests" << Close() <<
+            Tag("th") << "Hit ratio (%)" << Close() <<
+            Tag("th") << "Mean latency (us)" << Close() <<
+        Close() <<
+        StageRow("Rules", rules) <<
+        StageRow("Model", model) <<
+    Close() <<
+    P() << "Model time saved by the rules: " <<
+        std::to_string(rules.nb_hits * model.mean_seconds() * 1e3) << " ms" <<
+    Close();
+
+    html <<
+    H2() << "Rules" << Close() <<
+    P() << std::to_string(compiled->nb_dead()) << " of " <<
+        std::to_string(matcher.size()) << " rules have words unknown to "
+        "the model and never match" <<
+    Close() <<
+    Tag("table").AddClass("table") <<
+        Tag("tr") <<
+            Tag("th") << "Label" << Close() <<
+            Tag("th") << "Pattern" << Close() <<
+            Tag("th") << "Matches" << Close() <<
+        Close();
+
+    for (size_t i = 0; i < matcher.size(); ++i) {
+        const Rule& rule = matcher.rule(i);
+        html <<
+        Tag("tr") <<
+            Tag("td") << rule.key() << Close() <<
+            Tag("td") << rule.AsString() << Close() <<
+            Tag("td") << (matcher.IsDead(i) ? "never, unknown words"
+                    : "yes") << Close() <<
+        Close();
+    }
+    html << Close();
+    return html;
+}